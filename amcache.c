@@ -0,0 +1,261 @@
+/*
+ * Amiigo Link GATT handle cache
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  handles found by full discovery are kept on disk per device address,
+ *  along with the firmware version they were found on
+ *  each line is: <address> <major>.<minor>.<build> followed by
+ *  <handle>:<properties>:<value handle> in hex for each characteristic,
+ *  then the firmware build text (rest of the line, control characters are not kept)
+ *  changes are made in memory, the file is rewritten (to a temporary, then renamed)
+ *  by cache_flush on a decode thread, so session I/O threads never wait on it
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "amcache.h"
+
+#define CACHE_MAX_LINE 512
+
+// Handles of a single device
+typedef struct _amcache_entry {
+    char dst[18];                     // Device address
+    WEDVersion ver;                   // Firmware version the handles were found on
+    uint16_t handle[AMIIGO_UUID_COUNT];
+    uint8_t properties[AMIIGO_UUID_COUNT];
+    uint16_t value_handle[AMIIGO_UUID_COUNT];
+    char build[CACHE_BUILD_LEN];      // Firmware build text
+} amcache_entry_t;
+
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER; // Sessions share the cache
+static pthread_mutex_t g_cache_save_lock = PTHREAD_MUTEX_INITIALIZER; // One writer of the file at a time
+static int g_cache_dirty = 0; // If the file is behind the cache
+static const char * g_cache_path = NULL; // Cache file (NULL if disabled)
+static amcache_entry_t * g_cache = NULL;
+static int g_cache_count = 0;
+
+// Find the entry of a device (with lock held)
+static amcache_entry_t * cache_find(const char * dst) {
+    int i;
+    for (i = 0; i < g_cache_count; ++i) {
+        if (strcasecmp(g_cache[i].dst, dst) == 0)
+            return &g_cache[i];
+    }
+    return NULL;
+}
+
+// If a character is not printable, as in a line break of the build text
+static int cache_control(char c) {
+    return (unsigned char)c < 0x20 || c == 0x7f;
+}
+
+// Parse a single line of the cache file
+// Outputs:
+//   returns 0 if the line is a valid entry
+static int cache_parse(char * szLine, amcache_entry_t * entry) {
+    unsigned int major, minor, build;
+    int i, n;
+    memset(entry, 0, sizeof(*entry));
+    if (sscanf(szLine, "%17s %u.%u.%u%n", entry->dst, &major, &minor, &build, &n) != 4)
+        return -1;
+    entry->ver.Major = major;
+    entry->ver.Minor = minor;
+    entry->ver.Build = build;
+    szLine += n;
+    for (i = 0; i < AMIIGO_UUID_COUNT; ++i) {
+        unsigned int handle, properties, value_handle;
+        if (sscanf(szLine, " %x:%x:%x%n", &handle, &properties, &value_handle, &n) != 3)
+            return -1; // Characteristics changed since the entry was made
+        entry->handle[i] = handle;
+        entry->properties[i] = properties;
+        entry->value_handle[i] = value_handle;
+        szLine += n;
+    }
+    // Build text is optional
+    szLine += strspn(szLine, " ");
+    szLine[strcspn(szLine, "\n")] = 0;
+    for (i = 0; szLine[i]; ++i) {
+        if (cache_control(szLine[i]))
+            return -1; // Not written by us
+    }
+    snprintf(entry->build, sizeof(entry->build), "%s", szLine);
+    return 0;
+}
+
+// Write the cache file
+// Inputs:
+//   cache - entries to write
+//   count - number of entries
+static int cache_save(const amcache_entry_t * cache, int count) {
+    char szTemp[1024];
+    int i, j;
+    snprintf(szTemp, sizeof(szTemp), "%s.tmp", g_cache_path);
+    FILE * fp = fopen(szTemp, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot write handle cache %s (%d)\n", szTemp, errno);
+        return -1;
+    }
+    fprintf(fp, "# amlink GATT handle cache\n");
+    for (i = 0; i < count; ++i) {
+        const amcache_entry_t * entry = &cache[i];
+        fprintf(fp, "%s %u.%u.%u", entry->dst, entry->ver.Major, entry->ver.Minor, entry->ver.Build);
+        for (j = 0; j < AMIIGO_UUID_COUNT; ++j)
+            fprintf(fp, " %04x:%02x:%04x", entry->handle[j], entry->properties[j], entry->value_handle[j]);
+        fprintf(fp, " %s\n", entry->build);
+    }
+    if (fclose(fp) || rename(szTemp, g_cache_path)) {
+        fprintf(stderr, "Cannot write handle cache %s (%d)\n", g_cache_path, errno);
+        return -1;
+    }
+    return 0;
+}
+
+// If the cache has changes not written yet
+int cache_dirty(void) {
+    return __atomic_load_n(&g_cache_dirty, __ATOMIC_ACQUIRE);
+}
+
+// Write the cache file if anything has changed
+//  called on the decode threads, the entries are copied so lookups do not wait for the write
+int cache_flush(void) {
+    int ret = 0;
+    if (g_cache_path == NULL || !cache_dirty())
+        return 0;
+    pthread_mutex_lock(&g_cache_save_lock);
+    pthread_mutex_lock(&g_cache_lock);
+    int count = g_cache_count;
+    int dirty = g_cache_dirty; // Another decode thread may have written it meanwhile
+    amcache_entry_t * cache = NULL;
+    if (dirty) {
+        cache = malloc((count + 1) * sizeof(amcache_entry_t));
+        if (cache != NULL)
+            memcpy(cache, g_cache, count * sizeof(amcache_entry_t));
+        // Tried once, the next change writes it again
+        __atomic_store_n(&g_cache_dirty, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+    if (cache != NULL) {
+        ret = cache_save(cache, count);
+        free(cache);
+    } else if (dirty) {
+        fprintf(stderr, "Not enough memory to write handle cache %s\n", g_cache_path);
+        ret = -1;
+    }
+    pthread_mutex_unlock(&g_cache_save_lock);
+    return ret;
+}
+
+// Load the cache, a missing file is an empty cache
+// Inputs:
+//   path - cache file (NULL to disable the cache)
+int cache_load(const char * path) {
+    char szLine[CACHE_MAX_LINE];
+    g_cache_path = path;
+    if (path == NULL)
+        return 0;
+    FILE * fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    while (fgets(szLine, sizeof(szLine), fp) != NULL) {
+        amcache_entry_t entry;
+        if (szLine[0] == '#' || cache_parse(szLine, &entry))
+            continue;
+        amcache_entry_t * cache = realloc(g_cache, (g_cache_count + 1) * sizeof(amcache_entry_t));
+        if (cache == NULL)
+            break;
+        g_cache = cache;
+        g_cache[g_cache_count++] = entry;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Get the cached handles of a device
+// Outputs:
+//   chars - handles are filled in (uuids are left as they are)
+//   ver   - firmware version the handles were found on
+//   build - firmware build text of that version (empty if not known)
+//   returns 0 if device is in the cache, -1 otherwise
+int cache_lookup(const char * dst, struct gatt_char * chars, WEDVersion * ver, char * build, size_t len) {
+    int i, ret = -1;
+    pthread_mutex_lock(&g_cache_lock);
+    amcache_entry_t * entry = cache_find(dst);
+    if (entry != NULL) {
+        for (i = 0; i < AMIIGO_UUID_COUNT; ++i) {
+            chars[i].handle = entry->handle[i];
+            chars[i].properties = entry->properties[i];
+            chars[i].value_handle = entry->value_handle[i];
+        }
+        *ver = entry->ver;
+        snprintf(build, len, "%s", entry->build);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+    return ret;
+}
+
+// Keep the handles and firmware of a device
+//  the file is written later by cache_flush, only if anything has changed
+int cache_store(const char * dst, const WEDVersion * ver, const struct gatt_char * chars, const char * build) {
+    int i, ret = -1;
+    if (g_cache_path == NULL)
+        return 0;
+    amcache_entry_t update;
+    memset(&update, 0, sizeof(update));
+    snprintf(update.dst, sizeof(update.dst), "%s", dst);
+    update.ver = *ver;
+    for (i = 0; i < AMIIGO_UUID_COUNT; ++i) {
+        update.handle[i] = chars[i].handle;
+        update.properties[i] = chars[i].properties;
+        update.value_handle[i] = chars[i].value_handle;
+    }
+    snprintf(update.build, sizeof(update.build), "%s", build);
+    // Build text comes from the device, it must not break the line
+    for (i = 0; update.build[i]; ++i) {
+        if (cache_control(update.build[i]))
+            update.build[i] = '?';
+    }
+    pthread_mutex_lock(&g_cache_lock);
+    amcache_entry_t * entry = cache_find(dst);
+    if (entry == NULL) {
+        amcache_entry_t * cache = realloc(g_cache, (g_cache_count + 1) * sizeof(amcache_entry_t));
+        if (cache != NULL) {
+            g_cache = cache;
+            entry = &g_cache[g_cache_count++];
+            memset(entry, 0, sizeof(*entry));
+        }
+    } else if (strcmp(entry->dst, update.dst) == 0 && memcmp(entry, &update, sizeof(update)) == 0) {
+        entry = NULL; // Nothing new
+        ret = 0;
+    }
+    if (entry != NULL) {
+        *entry = update;
+        __atomic_store_n(&g_cache_dirty, 1, __ATOMIC_RELEASE);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+    return ret;
+}
+
+// Forget the handles of a device, they are not valid anymore
+void cache_invalidate(const char * dst) {
+    pthread_mutex_lock(&g_cache_lock);
+    amcache_entry_t * entry = cache_find(dst);
+    if (entry != NULL) {
+        *entry = g_cache[--g_cache_count];
+        __atomic_store_n(&g_cache_dirty, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+}
@@ -0,0 +1,27 @@
+/*
+ * Amiigo Link GATT handle cache
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMCACHE_H
+#define AMCACHE_H
+
+#include <stddef.h>
+
+#include "amidefs.h"
+#include "amchar.h"
+
+#define CACHE_FILE_NAME ".amlink_handles" // Default cache file, in home directory
+#define CACHE_BUILD_LEN 128               // Longest build text kept
+
+int cache_load(const char * path);
+int cache_lookup(const char * dst, struct gatt_char * chars, WEDVersion * ver, char * build, size_t len);
+int cache_store(const char * dst, const WEDVersion * ver, const struct gatt_char * chars, const char * build);
+void cache_invalidate(const char * dst);
+int cache_dirty(void);
+int cache_flush(void);
+
+#endif // include guard
@@ -9,11 +9,12 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "amchar.h"
 
-struct gatt_char g_char[AMIIGO_UUID_COUNT];
+struct gatt_char g_char[AMIIGO_UUID_COUNT]; // Defaults each device starts with
 
 // Client configuration (for notification and indication)
 const char * g_szUUID[] = {
@@ -29,7 +30,7 @@ const char * g_szUUID[] = {
 };
 
 // Initialize the characteristics with Amiigo defaults
-void char_init() {
+void char_init(void) {
     memset(g_char, 0, sizeof(g_char));
     int i;
     for (i = 0; i < AMIIGO_UUID_COUNT; ++i)
@@ -44,3 +45,8 @@ void char_init() {
     g_char[AMIIGO_UUID_BUILD].value_handle = 0x0030;
     g_char[AMIIGO_UUID_VERSION].value_handle = 0x0032;
 }
+
+// Start a device characteristics table from the defaults
+void char_reset(struct gatt_char * chars) {
+    memcpy(chars, g_char, sizeof(g_char));
+}
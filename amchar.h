@@ -28,4 +28,7 @@ enum {
 
 extern struct gatt_char g_char[AMIIGO_UUID_COUNT];
 
+void char_init(void);
+void char_reset(struct gatt_char * chars);
+
 #endif // include guard
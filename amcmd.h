@@ -31,7 +31,7 @@ typedef enum _AMIIGO_CMD {
     AMIIGO_CMD_EXTSTATUS,     // Extended status
 } AMIIGO_CMD;
 
-#define MAX_DEV_COUNT   10    // Maximum number of devices to work with
+#define MAX_SRC_COUNT   16    // Maximum number of adapters to work with
 typedef struct amiigo_config {
     WEDDebugI2CCmd i2c;          // i2c debugging
     WEDConfigLS config_ls;       // Light configuration
@@ -43,7 +43,10 @@ typedef struct amiigo_config {
     uint8 test_mode;             // accel test mode
     // Device and interface to use
     int count_dst;
-    char * dst[MAX_DEV_COUNT];
+    int alloc_dst;               // Number of allocated device entries
+    char ** dst;
+    int count_src;
+    char * src[MAX_SRC_COUNT];
 } amcfg_t;
 
 extern AMIIGO_CMD g_cmd;
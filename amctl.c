@@ -0,0 +1,310 @@
+/*
+ * Amiigo Link control input (user, signals and stop request)
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  stdin, signals and session completion are all waited on in the main thread,
+ *  sessions only watch stop_fd in their own epoll set, so no syscall is made
+ *  on the receive path to check for user input
+ *
+ *  in daemon mode requests come in on a UNIX control socket, one per connection:
+ *    <command> <device>\n
+ *  they are handed to the session of the device, which replies once done:
+ *    ok <device> Build: ... Version: ... Logs: ... Battery: ...% Status: ...\n
+ *    error <device> <reason>\n
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "amcmd.h"
+#include "cmdparse.h"
+#include "amsession.h"
+#include "amctl.h"
+
+#define CTL_MAX_LINE 256 // Longest control request line
+#define CTL_BACKLOG 16 // Control clients waiting to be accepted
+
+amctl_t g_ctl = {-1, -1, -1, -1, 0};
+
+// A control client sending its request
+typedef struct _amclient {
+    int fd;
+    int len;
+    char buf[CTL_MAX_LINE];
+} amclient_t;
+
+static struct termios g_oldt; // Terminal settings to restore
+
+// Listen for control requests
+static int ctl_listen(const char * szPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(szPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long (%s)\n", szPath);
+        return -1;
+    }
+    strcpy(addr.sun_path, szPath);
+
+    g_ctl.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_ctl.listen_fd < 0) {
+        fprintf(stderr, "socket() error (%d) for control\n", errno);
+        return -1;
+    }
+    // Remove stale socket of a previous run
+    unlink(szPath);
+    if (bind(g_ctl.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+            || listen(g_ctl.listen_fd, CTL_BACKLOG) < 0) {
+        fprintf(stderr, "Cannot listen on %s (%d)\n", szPath, errno);
+        close(g_ctl.listen_fd);
+        g_ctl.listen_fd = -1;
+        return -1;
+    }
+    printf("Listening for requests on %s\n", szPath);
+    return 0;
+}
+
+// Initialize control input
+//  must be called before any session thread starts, so signals are blocked in all threads
+int ctl_init(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+        fprintf(stderr, "pthread_sigmask() error\n");
+        return -1;
+    }
+    // A control client may be gone by the time its reply is written, that must not end the run
+    signal(SIGPIPE, SIG_IGN);
+    g_ctl.sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (g_ctl.sig_fd < 0) {
+        fprintf(stderr, "signalfd() error (%d)\n", errno);
+        return -1;
+    }
+    g_ctl.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    g_ctl.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_ctl.stop_fd < 0 || g_ctl.done_fd < 0) {
+        fprintf(stderr, "eventfd() error (%d)\n", errno);
+        return -1;
+    }
+
+    if (g_opt.ctl_path != NULL && ctl_listen(g_opt.ctl_path))
+        return -1;
+
+    // Get single key presses, once for the whole run
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &g_oldt) == 0) {
+        struct termios newt = g_oldt;
+        newt.c_lflag &= ~(ICANON | ECHO);
+        newt.c_cc[VMIN] = 1;
+        newt.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &newt) == 0)
+            g_ctl.tty = 1;
+    }
+    return 0;
+}
+
+// Restore the terminal and release control input
+void ctl_close(void) {
+    if (g_ctl.tty) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &g_oldt);
+        g_ctl.tty = 0;
+    }
+    if (g_ctl.sig_fd >= 0)
+        close(g_ctl.sig_fd);
+    if (g_ctl.stop_fd >= 0)
+        close(g_ctl.stop_fd);
+    if (g_ctl.done_fd >= 0)
+        close(g_ctl.done_fd);
+    if (g_ctl.listen_fd >= 0) {
+        close(g_ctl.listen_fd);
+        unlink(g_opt.ctl_path);
+    }
+    g_ctl.sig_fd = g_ctl.stop_fd = g_ctl.done_fd = g_ctl.listen_fd = -1;
+}
+
+// Ask all sessions to end
+//  stop_fd is never read, so it stays readable in every session epoll set
+void ctl_stop(void) {
+    uint64_t val = 1;
+    if (write(g_ctl.stop_fd, &val, sizeof(val)) != sizeof(val))
+        fprintf(stderr, "eventfd write error (%d)\n", errno);
+}
+
+// Last session ended
+void ctl_sessions_done(void) {
+    uint64_t val = 1;
+    if (write(g_ctl.done_fd, &val, sizeof(val)) != sizeof(val))
+        fprintf(stderr, "eventfd write error (%d)\n", errno);
+}
+
+static int ctl_add(int efd, int fd, void * ptr) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    return epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Reply with an error and close the control client
+static void ctl_reply_error(int fd, const char * szError) {
+    char szReply[CTL_MAX_LINE + 64];
+    int len = snprintf(szReply, sizeof(szReply), "error %s\n", szError);
+    int ret = (int)write(fd, szReply, len);
+    if (ret != len) {
+        if (ret < 0 && errno == EPIPE)
+            fprintf(stderr, "Control client is gone\n");
+        else
+            fprintf(stderr, "Could not reply to the control client\n");
+    }
+    close(fd);
+}
+
+// Hand a complete request line to the session of its device
+static void ctl_request(amsession_t * sessions, int fd, char * szLine) {
+    char * saveptr = NULL;
+    char * szCmd = strtok_r(szLine, " \t\r\n", &saveptr);
+    char * szDev = strtok_r(NULL, " \t\r\n", &saveptr);
+    if (szCmd == NULL || szDev == NULL) {
+        ctl_reply_error(fd, "usage: <command> <device>");
+        return;
+    }
+    int cmd = command_from_name(szCmd);
+    if (cmd < 0 || cmd == AMIIGO_CMD_FWUPDATE) {
+        ctl_reply_error(fd, "invalid command");
+        return;
+    }
+    int dev_idx;
+    for (dev_idx = 0; dev_idx < g_cfg.count_dst; ++dev_idx) {
+        if (strcasecmp(g_cfg.dst[dev_idx], szDev) == 0)
+            break;
+    }
+    if (dev_idx == g_cfg.count_dst) {
+        ctl_reply_error(fd, "unknown device");
+        return;
+    }
+    if (session_submit(&sessions[session_of_device(dev_idx)], dev_idx, cmd, fd))
+        ctl_reply_error(fd, "not enough memory");
+}
+
+// Read from a control client until its request line is complete
+// Outputs:
+//   returns non-zero if the client is done with (handed off or closed)
+static int ctl_client_read(amsession_t * sessions, int efd, amclient_t * client) {
+    int len = read(client->fd, &client->buf[client->len], CTL_MAX_LINE - 1 - client->len);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+    if (len > 0) {
+        client->len += len;
+        client->buf[client->len] = 0;
+        if (strchr(client->buf, '\n') == NULL && client->len < CTL_MAX_LINE - 1)
+            return 0;
+    }
+    // Stop watching before the session takes over the fd
+    epoll_ctl(efd, EPOLL_CTL_DEL, client->fd, NULL);
+    if (len > 0)
+        ctl_request(sessions, client->fd, client->buf);
+    else
+        close(client->fd);
+    return 1;
+}
+
+// Wait for the sessions to end, while watching for the user to end the run
+//  in daemon mode also serve control requests
+int ctl_run(amsession_t * sessions) {
+    int efd = epoll_create1(EPOLL_CLOEXEC);
+    if (efd < 0) {
+        fprintf(stderr, "epoll_create1() error (%d)\n", errno);
+        return -1;
+    }
+    if (ctl_add(efd, g_ctl.done_fd, &g_ctl.done_fd) || ctl_add(efd, g_ctl.sig_fd, &g_ctl.sig_fd)
+            || (g_ctl.listen_fd >= 0 && ctl_add(efd, g_ctl.listen_fd, &g_ctl.listen_fd))) {
+        fprintf(stderr, "epoll_ctl() error (%d) for control\n", errno);
+        close(efd);
+        return -1;
+    }
+    // stdin may be closed or not pollable (e.g. /dev/null) under supervisors, then signals are enough
+    static int stdin_fd = STDIN_FILENO;
+    int bStdin = (ctl_add(efd, STDIN_FILENO, &stdin_fd) == 0);
+
+    int bDone = 0;
+    while (!bDone) {
+        struct epoll_event events[16];
+        int nfds = epoll_wait(efd, events, 16, -1);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "control epoll_wait() error (%d)\n", errno);
+            ctl_stop();
+            break;
+        }
+        int k;
+        for (k = 0; k < nfds; ++k) {
+            void * ptr = events[k].data.ptr;
+            if (ptr == &g_ctl.done_fd) {
+                bDone = 1;
+            } else if (ptr == &g_ctl.sig_fd) {
+                struct signalfd_siginfo si;
+                if (read(g_ctl.sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                    fprintf(stderr, " (Signal %u, ending the run)\n", si.ssi_signo);
+                    ctl_stop();
+                }
+            } else if (ptr == &stdin_fd) {
+                if (!bStdin)
+                    continue;
+                char buf[64];
+                int len = read(STDIN_FILENO, buf, sizeof(buf));
+                if (len > 0) {
+                    if (memchr(buf, 'q', len) != NULL)
+                        ctl_stop();
+                } else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    // End of input, keep running until done or signaled
+                    epoll_ctl(efd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                    bStdin = 0;
+                }
+            } else if (ptr == &g_ctl.listen_fd) {
+                int fd = accept(g_ctl.listen_fd, NULL, NULL);
+                if (fd < 0)
+                    continue;
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                amclient_t * client = calloc(1, sizeof(amclient_t));
+                if (client == NULL) {
+                    close(fd);
+                    continue;
+                }
+                client->fd = fd;
+                if (ctl_add(efd, fd, client)) {
+                    close(fd);
+                    free(client);
+                }
+            } else {
+                amclient_t * client = ptr;
+                // Closed, or owned by its session now
+                if (ctl_client_read(sessions, efd, client))
+                    free(client);
+            }
+        }
+    }
+
+    close(efd);
+    return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * Amiigo Link control input (user, signals and stop request)
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMCTL_H
+#define AMCTL_H
+
+struct _amsession;
+
+// Control file descriptors shared by all the sessions
+typedef struct _amctl {
+    int stop_fd;        // eventfd that becomes (and stays) readable once the run must end
+    int done_fd;        // eventfd signaled when the last session ends
+    int sig_fd;         // signalfd for SIGINT and SIGTERM
+    int listen_fd;      // Control socket accepting requests (daemon mode)
+    int tty;            // If stdin is a terminal put in raw mode
+} amctl_t;
+
+extern amctl_t g_ctl;
+
+int ctl_init(void);
+void ctl_close(void);
+void ctl_stop(void);
+void ctl_sessions_done(void);
+int ctl_run(struct _amsession * sessions);
+
+#endif // include guard
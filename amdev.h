@@ -11,9 +11,30 @@
 
 #include <stdio.h>
 #include "amidefs.h"
+#include "amcmd.h"
+#include "amtimer.h"
+#include "amring.h"
+#include "amchar.h"
+
+#define RX_BATCH 32       // Most PDUs to receive in one call
+#define RX_PDU_MAX 1024   // Largest PDU to receive
+#define ATT_MTU_MAX 517   // Largest ATT MTU to negotiate (512 bytes of value)
+#define RX_RING_SIZE (256 * 1024) // Notifications waiting to be decoded, per device
+#define CONN_INTR_FAST 6  // Shortest connection interval the device takes (1.25ms units)
+#define CONN_INTR_SLOW 32 // Longest connection interval the device takes, to save power
+#define CONN_TIMEOUT 300  // Supervision timeout (10ms units)
+
+// Ring entry that starts a download, ahead of its notifications
+#define DECODE_START 0x00 // followed by 32-bit generation, 32-bit total logs and reconnected flag
+#define DECODE_START_SIZE 10
+
+struct _amsession;
+struct _amtrans;
+struct _amops;
 
 typedef enum _DISCOVERY_STATE {
     STATE_NONE = 0,
+    STATE_CONNECTING,
     STATE_BUILD,
     STATE_VERSION,
     STATE_STATUS,
@@ -22,19 +43,50 @@ typedef enum _DISCOVERY_STATE {
     STATE_FWSTATUS_WAIT,
     STATE_I2C,
     STATE_EXTSTATUS,
+    STATE_IDLE,         // Connected and waiting for the next request (daemon mode)
+    STATE_RECONNECT,    // Connection lost, waiting to reconnect
 
     STATE_COUNT, // This must be the last
 } DISCOVERY_STATE;
 
+typedef enum _DEV_TIMER {
+    TIMER_CONNECT = 0,  // Connection time out
+    TIMER_KEEPALIVE,    // Keep-alive status read
+    TIMER_DOWNLOAD,     // Download idle time out
+    TIMER_FWPOLL,       // Firmware update status polling
+    TIMER_RECONNECT,    // Reconnect after backoff
+    TIMER_TRANS,        // ATT request time out
+
+    TIMER_COUNT, // This must be the last
+} DEV_TIMER;
+
+typedef enum _HANDLES_SOURCE {
+    HANDLES_DEFAULT = 0, // Amiigo default handles
+    HANDLES_CACHED,      // Handle cache, verified against firmware version
+    HANDLES_DISCOVERED,  // Full discovery on this connection
+} HANDLES_SOURCE;
+
 // Keep the state of each device here
 typedef struct _amdev {
     int dev_idx;               // device index
     int started;               // If command is sent
-    int done;                  // If comamnd to do on device is done
+    AMIIGO_CMD cmd;            // Command to execute on this device
+    int cmd_done;              // If the command finished, a reconnect goes back to idle (daemon mode)
+    uint64_t idle_time;        // When the device last went idle, in ms (daemon mode)
+    int req_fd;                // Control client waiting for the command to finish (-1 if none)
+    int failed;                // If device failed and is out of the session
+    int retries;               // Reconnects since the last command finished
     DISCOVERY_STATE state;     // Device state machine state
     int sock;                  // Socket openned for this device
+    uint16_t mtu;              // ATT MTU of the connection
     WEDVersion ver;            // Firmware version
+    struct gatt_char chars[AMIIGO_UUID_COUNT]; // Characteristics of this device
+    HANDLES_SOURCE handles;    // Where the characteristics handles came from
+    uint16_t disc_end;         // Last handle of the range being discovered
+    uint32_t disc_found;       // Characteristics found so far by discovery (bit per index)
+    WEDVersion cache_ver;      // Firmware version the cached handles were found on
     unsigned int ver_flat;     // Flat version number to compare
+    const struct _amops * ops; // Protocol of the firmware generation
     WEDStatus status;          // Firmware status
     struct {
         uint8 type; // WED_LOG_TAG
@@ -43,12 +95,41 @@ typedef struct _amdev {
     } PACKED logTag;           // Last tag
     WEDLogTimestamp logTime;   // Last timestamp packet
     WEDLogAccel logAccel;      // Last accel
-    uint32_t read_logs;        // Logs downloaded so far
-    uint32_t total_logs;       // Total number of logs tp be downloaded
+    uint32_t read_logs;        // Logs downloaded so far (decode thread)
+    uint32_t total_logs;       // Total number of logs tp be downloaded (decode thread)
     int bValidAccel;           // If any uncompressed accel is received
     char szBuild[512];         // Firmware build text
     char szVersion[512];       // Firmware version text
     FILE * logFile;            // file to download logs
+    void * sink_ctx;           // Output state of the record sink
+    amtimers_t * sched;        // Timers of the session this device belongs to
+    amtimer_t timers[TIMER_COUNT]; // Device deadlines
+    uint64_t download_time;    // Last time a packet came (ms)
+    uint8_t rx_buf[RX_BATCH][RX_PDU_MAX]; // PDUs received in one batch
+    int rx_len[RX_BATCH];      // Length of each PDU in the batch
+    struct _amsession * session; // Session this device belongs to
+    struct _amdev * dec_next;  // Next closed device for the decode thread to release
+    amring_t ring;             // Notifications waiting to be decoded
+    int relinked;              // If reconnected since the last download started
+    uint32_t dl_gen;           // Last download started (session thread)
+    uint32_t dec_gen;          // Download being decoded (decode thread)
+    uint32_t done_gen;         // Last download fully decoded (decode thread)
+    uint32_t rx_tag;           // Tag of the io_uring receive in flight (0 if none)
+    struct _amtrans * trans;   // ATT request waiting for its response (NULL if none)
+    struct _amtrans * trans_queue; // ATT requests waiting to be sent
+    struct _amtrans ** trans_tail; // Where to queue the next ATT request
+    struct _amtrans * trans_pool; // Preallocated ATT requests
+    struct _amtrans * trans_free; // ATT requests ready to be used
+    uint32_t trans_spills;     // ATT requests allocated because the pool was exhausted
+    uint16_t conn_handle;      // HCI handle of the connection (0 if not known)
+    uint16_t conn_intr;        // Connection interval in effect in 1.25ms units (0 if not known)
+    int conn_fast;             // If switched to the fast connection interval for download
+    int wl_wait;               // If waiting for the adapter to connect through the whitelist
+    int tx_wait;               // If waiting for the socket to take more writes
+    uint32_t fw_written;       // Firmware image bytes taken by the socket
+    uint16_t fw_page;          // Firmware image pages taken by the socket
+    int fw_tx;                 // What firmware update sends next (FWUP_TX_*)
+    uint32_t fw_tx_blocks;     // Firmware blocks left to send in this round
 } amdev_t;
 
 #endif // include guard
@@ -15,6 +15,7 @@ import re
 import os
 from subprocess import Popen, PIPE, STDOUT
 import signal
+import socket
 from threading import Thread
 
 try:
@@ -46,8 +47,9 @@ __version__ = 1.6
 
 
 class AmiigoDevice():
-    def __init__(self, force_amlink=False, force=False, adapter=''):
+    def __init__(self, force_amlink=False, force=False, adapter='', daemon_socket=''):
         self.done = False
+        self.daemon_socket = daemon_socket
         self.force_amlink = force_amlink
         self.force = force
         self.amiigos = {}
@@ -99,6 +101,25 @@ class AmiigoDevice():
                 battery = m[0]
         return charging, battery, recording, logs, version
 
+    def _daemon_request(self, cmd, dut):
+        """send a request to amlink running in daemon mode
+        returns the reply line
+        """
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        s.settimeout(self.max_timeout)
+        try:
+            s.connect(self.daemon_socket)
+            s.sendall(('%s %s\n' % (cmd, dut)).encode())
+            reply = b''
+            while not reply.endswith(b'\n'):
+                data = s.recv(1024)
+                if not data:
+                    break
+                reply = reply + data
+        finally:
+            s.close()
+        return reply.decode().rstrip()
+
     def test(self, dut):
         """test blink
         """
@@ -107,6 +128,18 @@ class AmiigoDevice():
         
         passed = False
 
+        if self.daemon_socket:
+            reply = self._daemon_request('blink', dut)
+            logger.info(reply)
+            if reply.startswith('ok '):
+                passed = True
+                m = re.findall('Status:\s0x(?P<status>[0-9a-f]+)', reply)
+                charging = bool(m) and (int(m[0], 16) & 0x04) != 0  # STATUS_CHARGING
+            else:
+                print('\tblink test did not pass, try again or change device')
+            sys.stdout.flush()
+            return passed, charging
+
         cmds = self.cmds_base + ['--b', dut]
 
         cmds = cmds + ['--c', 'blink']
@@ -406,6 +439,8 @@ def main():
     parser.add_argument("-f", "--force", dest="force", help="Force reset the adapter.", 
                         action="store_true")
     parser.add_argument("-i", "--interface", dest="interface", help="Interface adapter (default is hci0).")
+    parser.add_argument("-s", "--socket", dest="socket", default='',
+                        help="Control socket of amlink running with --daemon.")
     parser.add_argument("-t", "--test", dest="dut", nargs='1', help="Test a wristband given MAC address")
 
     if len(sys.argv) == 1:
@@ -421,7 +456,8 @@ def main():
         logger.setLevel("DEBUG")
     dev = AmiigoDevice(force_amlink=options.amlink, 
                        force=options.force,
-                       adapter=options.interface)
+                       adapter=options.interface,
+                       daemon_socket=options.socket)
 
     if options.discover:
         dev.discover(console=True)
@@ -18,68 +18,47 @@
 #include "amidefs.h"
 #include "amdev.h"
 #include "amlprocess.h"
+#include "amsession.h"
+#include "amtrans.h"
+#include "amcache.h"
 #include "amchar.h"
+#include "amsink.h"
+#include "amops.h"
 #include "gapproto.h"
 #include "fwupdate.h"
 
-/******************************************************************************/
-typedef struct {
-    uint8* buf;
-    uint8 pos;
-} GetBits;
-/******************************************************************************/
-static inline void cmpGetBitsInit(GetBits* gb, void* buf) {
-
-    gb->buf = buf;
-    gb->pos = 0;
-}
-/******************************************************************************/
-static int8 cmpGetBits(GetBits* gb, uint8 nbits) {
-
-    int8 val = gb->buf[0] << gb->pos;
-
-    uint8 buf0bits = 8 - gb->pos;
-    if (buf0bits < nbits)
-        val |= gb->buf[1] >> buf0bits;
-
-    gb->pos += nbits;
-    if (gb->pos >= 8) {
-        gb->buf++;
-        gb->pos -= 8;
+// Unpack all the deltas of a compressed accel entry at once
+//  deltas are packed starting from the high bit of the first byte, X0 Y0 Z0 X1 ...
+// Inputs:
+//   pdu   - packed deltas
+//   count - number of deltas
+//   nbits - bits per delta (3 to 6)
+// Outputs:
+//   diffs - sign extended deltas
+static void cmpUnpack(const uint8 * pdu, int count, uint8 nbits, int8 * diffs) {
+    uint64_t acc = 0; // Bits not unpacked yet, aligned to the top
+    int avail = 0;    // Number of bits in acc
+    int k;
+    for (k = 0; k < count; ++k) {
+        if (avail < nbits) {
+            // A delta spans at most two bytes, refill one byte at a time
+            acc |= (uint64_t)(*pdu++) << (56 - avail);
+            avail += 8;
+        }
+        diffs[k] = (int8)((int64_t)acc >> (64 - nbits));
+        acc <<= nbits;
+        avail -= nbits;
     }
-
-    return val >> (8 - nbits);
 }
 
 char g_szBaseName[256] = {0};
-// Open file for logging
-// Inputs:
-//   szBase - the base name of the log
-FILE * log_file_open(amdev_t * dev) {
-    // Downloaded file
-    char szFullName[1024] = { 0 };
-
+// Initialize the base name of the logs
+//  must be called before any session starts downloading
+void log_init(void) {
     time_t now = time(NULL);
     // Use date-time to avoid overwriting logs
     if (g_szBaseName[0] == 0)
         strftime(g_szBaseName, 256, "Log_%Y-%m-%d-%H-%M-%S", localtime(&now));
-
-    // Use other metadata to distinguish each log
-    if (dev->dev_idx == 0) {
-        if (strchr(g_szBaseName, '.'))
-            sprintf(szFullName, "%s", g_szBaseName);
-        else
-            sprintf(szFullName, "%s.log", g_szBaseName);
-    } else {
-        if (strchr(g_szBaseName, '.'))
-            sprintf(szFullName, "d%d_%s", dev->dev_idx, g_szBaseName);
-        else
-            sprintf(szFullName, "d%d_%s.log", dev->dev_idx, g_szBaseName);
-    }
-    printf("\ndownloading %s ...\n", szFullName);
-
-    FILE * fp = fopen(szFullName, g_opt.append ? "a" : "w");
-    return fp;
 }
 
 // Dump content of the buffer
@@ -93,17 +72,6 @@ int dump_buffer(uint8_t * buf, ssize_t buflen) {
     return 0;
 }
 
-// Add a single accel log line to the file (and optionally to console)
-void add_accel_line(FILE * logFile, const WEDLogAccel * logAccel) {
-    char log_line[512] = {0};
-    sprintf(log_line, "[\"accelerometer\",[%d,%d,%d]]\n", logAccel->accel[0], logAccel->accel[1], logAccel->accel[2]);
-    fprintf(logFile, log_line);
-    if (g_opt.console) {
-        printf(log_line);
-        fflush(stdout);
-    }
-}
-
 uint8 cmpNbits(int16 diff) {
 
     uint8 v = (diff < 0) ? ~diff : diff;
@@ -135,7 +103,35 @@ int8 decode_accel(int8 old_accel, int8 diff, uint8 nbits) {
     return accel;
 }
 
+// Let the session know all the logs of this download are decoded
+static void download_done(amdev_t * dev) {
+    __atomic_store_n(&dev->done_gen, dev->dec_gen, __ATOMIC_RELEASE);
+}
+
+// Start decoding a new download
+//  comes through the ring ahead of the download notifications
+int process_download_start(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
+    if (buflen < DECODE_START_SIZE)
+        return -1;
+    dev->dec_gen = att_get_u32(&buf[1]);
+    dev->total_logs = att_get_u32(&buf[5]);
+    dev->read_logs = 0;
+    // Compressed accel cannot continue from before the link was lost
+    if (buf[9])
+        dev->bValidAccel = 0;
+    return 0;
+}
+
+// Hand the current accel sample to the sink
+static void emit_accel(amdev_t * dev) {
+    amrecord_t rec;
+    rec.type = RECORD_ACCEL;
+    memcpy(rec.accel.accel, dev->logAccel.accel, sizeof(rec.accel.accel));
+    sink_record(dev, &rec);
+}
+
 // Continue downloading packets
+//  each log entry is decoded to records for the sink
 int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
     int i;
     uint16_t handle = 0;
@@ -143,18 +139,13 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
     handle = att_get_u16(&buf[1]);
     if (buflen < 4) {
         printf("Last notification handle = 0x%04x\n", handle);
-        dev->state = STATE_COUNT;
+        download_done(dev);
         return 0;
     }
 
     // Note: Each packet starts a log entry
 
-    WEDLogAccelCmp logAccelCmp;
-    WEDLogLSData logLSData;
-    WEDLogTemp logTemp;
-    WEDLogLSConfig logLSConfig;
-    WEDLogCount logCount;
-    WEDLogEvent logEvent;
+    amrecord_t rec;
 
     // TODO: check packet sizes
     // TODO: check data integrity
@@ -168,17 +159,13 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
             dev->read_logs++; // Total number of log points downloaded so far
 
         switch (log_type) {
-        uint16_t val16;
-        uint8_t field_count, reset_detected;
+        uint8_t field_count, count_bits, reset_detected;
         uint8_t * pdu;
         int nbits;
 
         case WED_LOG_TIME:
             packet_len = sizeof(dev->logTime);
 
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
             dev->logTime.type = log_type;
             dev->logTime.timestamp = att_get_u32(&buf[payload + 1]);
             dev->logTime.flags = buf[payload + 5];
@@ -187,129 +174,69 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
             if (reset_detected)
                 printf(" (reboot detected)\n");
 
-            fprintf(dev->logFile, "[\"timestamp\",[%u,%u]]\n", dev->logTime.timestamp, dev->logTime.flags);
-
+            rec.type = RECORD_TIMESTAMP;
+            rec.time.timestamp = dev->logTime.timestamp;
+            rec.time.flags = dev->logTime.flags;
+            sink_record(dev, &rec);
             break;
         case WED_LOG_EVENT:
-            packet_len = sizeof(logEvent);
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-            logEvent.type = log_type;
-            logEvent.flags = buf[payload + 1];
-            fprintf(dev->logFile, "[\"event\",[\"flags\",%u]]\n", logEvent.flags);
+            packet_len = sizeof(WEDLogEvent);
+            rec.type = RECORD_EVENT;
+            rec.event.flags = buf[payload + 1];
+            sink_record(dev, &rec);
             break;
         case WED_LOG_COUNT:
-            packet_len = sizeof(logCount);
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-            logCount.type = log_type;
-            logCount.log_timestamp = att_get_u32(&buf[payload + 1]);
-            logCount.log_accel_count = att_get_u32(&buf[payload + 5]);
-            logCount.old_timestamp = att_get_u32(&buf[payload + 7]);
-            logCount.timestamp = att_get_u32(&buf[payload + 11]);
-            fprintf(dev->logFile, "[\"log_count\",[\"log_timestamp\",%u],"
-                    "[\"log_accel_count\",%u],[\"old_timestamp\",%u],[\"timestamp\",%u]]\n", logCount.log_timestamp,
-                    logCount.log_accel_count, logCount.old_timestamp, logCount.timestamp);
+            packet_len = sizeof(WEDLogCount);
+            rec.type = RECORD_COUNT;
+            rec.count.log_timestamp = att_get_u32(&buf[payload + 1]);
+            rec.count.log_accel_count = att_get_u16(&buf[payload + 5]);
+            rec.count.old_timestamp = att_get_u32(&buf[payload + 7]);
+            rec.count.timestamp = att_get_u32(&buf[payload + 11]);
+            sink_record(dev, &rec);
             break;
         case WED_LOG_ACCEL:
             packet_len = sizeof(dev->logAccel);
 
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
             dev->bValidAccel = 1;
             dev->logAccel.type = log_type;
             for (i = 0; i < 3; ++i)
                 dev->logAccel.accel[i] = buf[payload + 1 + i];
-            add_accel_line(dev->logFile, &dev->logAccel);
+            emit_accel(dev);
             break;
         case WED_LOG_LS_CONFIG:
-            packet_len = sizeof(logLSConfig);
-
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
-            logLSConfig.type = log_type;
-            logLSConfig.dac_on = buf[payload + 1];
-            logLSConfig.flags = buf[payload + 2];
-            logLSConfig.level_led = buf[payload + 3];
-            logLSConfig.gain = buf[payload + 4];
-            logLSConfig.log_size = buf[payload + 5];
-            fprintf(dev->logFile, "[\"lightsensor_config\",[\"dac_on\",%u],"
-                    "[\"flags\",%u],[\"level_led\",%u],[\"gain\",%u],[\"log_size\",%u]]\n", logLSConfig.dac_on, logLSConfig.flags,
-                    logLSConfig.level_led, logLSConfig.gain, logLSConfig.log_size);
+            packet_len = sizeof(WEDLogLSConfig);
+
+            rec.type = RECORD_LS_CONFIG;
+            rec.ls_config.dac_on = buf[payload + 1];
+            rec.ls_config.flags = buf[payload + 2];
+            rec.ls_config.level_led = buf[payload + 3];
+            rec.ls_config.gain = buf[payload + 4];
+            rec.ls_config.log_size = buf[payload + 5];
+            sink_record(dev, &rec);
             break;
         case WED_LOG_LS_DATA:
-            logLSData.type = log_type;
-            if (dev->ver_flat < FW_VERSION(1,8,84))
-            {
-                packet_len = 3 + (sizeof(uint16) * (((WEDLogLSData*)&buf[payload])->val[0] >> 14));
-                val16 = att_get_u16(&buf[payload + 1]);
-                field_count = ((val16 & 0xC000) >> 14) + 1;
-                if (field_count > 3) {
-                    fprintf(stderr, "Invalid LS_DATA ignored\n");
-                    break;
-                }
-                logLSData.val[0] = val16 & 0x3FFF;
-                for (i = 1; i < field_count; ++i)
-                    logLSData.val[i] = att_get_u16(&buf[payload + 1 + i * 2]);
-                val16 = 0;
-                switch(field_count)
-                {
-                case 1:
-                    val16 = 2;
-                    break;
-                case 2:
-                    val16 = 6;
-                    break;
-                case 3:
-                    val16 = 7;
-                    break;
-                }
-            } else {
-                packet_len = WEDLogLSDataSize(&buf[payload]);
-                val16 = (buf[payload] & 0xE0) >> 5;
-                field_count = (val16 & 1 ? 1 : 0) + (val16 & 2 ? 1 : 0) + (val16 & 4 ? 1 : 0);
-                for (i = 0; i < field_count; ++i)
-                    logLSData.val[i] = att_get_u16(&buf[payload + 1 + i * 2]);
-            }
-
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
-            if (field_count)
-            {
-                int cnt = 0;
-                fprintf(dev->logFile, "[\"lightsensor\"");
-                if (val16 & 1 ? 1 : 0)
-                    fprintf(dev->logFile, ",[\"red\",%u]", logLSData.val[cnt++]);
-                if (val16 & 2 ? 1 : 0)
-                    fprintf(dev->logFile, ",[\"ir\",%u]", logLSData.val[cnt++]);
-                if (val16 & 4 ? 1 : 0)
-                    fprintf(dev->logFile, ",[\"off\",%u]", logLSData.val[cnt++]);
-                fprintf(dev->logFile, "]\n");
+            rec.type = RECORD_LS_DATA;
+            if (dev->ops->ls_data(&buf[payload], &packet_len, &rec)) {
+                fprintf(stderr, "Invalid LS_DATA ignored\n");
+                break;
             }
-
+            sink_record(dev, &rec);
             break;
         case WED_LOG_TEMP:
-            packet_len = sizeof(logTemp);
-
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
+            packet_len = sizeof(WEDLogTemp);
 
-            logTemp.type = log_type;
-            logTemp.temperature = att_get_u16(&buf[payload + 1]);
-            fprintf(dev->logFile, "[\"temperature\",%d]\n", logTemp.temperature);
+            rec.type = RECORD_TEMP;
+            rec.temp.temperature = att_get_u16(&buf[payload + 1]);
+            sink_record(dev, &rec);
             break;
         case WED_LOG_TAG:
             packet_len = sizeof(dev->logTag);
 
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
             dev->logTag.type = log_type;
             memcpy(&dev->logTag.tag, &buf[payload + 1], 4);
-            fprintf(dev->logFile, "[\"tag\",%u]\n", dev->logTag.tag);
+            rec.type = RECORD_TAG;
+            rec.tag.tag = dev->logTag.tag;
+            sink_record(dev, &rec);
             break;
         case WED_LOG_ACCEL_CMP:
             packet_len = WEDLogAccelCmpSize(&buf[payload]);
@@ -318,26 +245,20 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
                 break;
             }
 
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
-            logAccelCmp.type = log_type;
-            logAccelCmp.count_bits = buf[payload + 1];
-            field_count = (logAccelCmp.count_bits & 0xF) + 1;
+            count_bits = buf[payload + 1];
+            field_count = (count_bits & 0xF) + 1;
             dev->read_logs += field_count;
             if (g_opt.leave_compressed) {
-                fprintf(dev->logFile, "[\"accelerometer_compressed\",[\"count_bits\",%u],[\"data\",[",logAccelCmp.count_bits);
-                for (i = 0; i < packet_len - 2; ++i) {
-                    fprintf(dev->logFile, "%u", buf[payload + 2 + i]);
-                    if (i < packet_len - 3)
-                        fprintf(dev->logFile, ",");
-                }
-                fprintf(dev->logFile, "]]]\n");
+                rec.type = RECORD_ACCEL_CMP;
+                rec.accel_cmp.count_bits = count_bits;
+                rec.accel_cmp.len = packet_len - 2;
+                rec.accel_cmp.data = &buf[payload + 2];
+                sink_record(dev, &rec);
                 break;
             }
 
             nbits = -1;
-            switch ((logAccelCmp.count_bits & 0x70) >> 4) {
+            switch ((count_bits & 0x70) >> 4) {
             case WED_LOG_ACCEL_CMP_3_BIT:
                 nbits = 3;
                 break;
@@ -355,7 +276,7 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
                 dev->bValidAccel = 1;
                 break;
             case WED_LOG_ACCEL_CMP_STILL:
-                if (logAccelCmp.count_bits & 0x80)
+                if (count_bits & 0x80)
                     nbits = 0;
                 break;
             default:
@@ -371,13 +292,10 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
             if (!dev->bValidAccel)
                 break;
 
-            if (dev->logFile == NULL)
-                dev->logFile = log_file_open(dev);
-
             if (nbits == 0) {
                 // It is still, just replicate
                 while (field_count--)
-                    add_accel_line(dev->logFile, &dev->logAccel);
+                    emit_accel(dev);
                 break;
             }
             pdu = &buf[payload];
@@ -388,18 +306,22 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
                     for (i = 0; i < 3; ++i)
                         dev->logAccel.accel[i] = pdu[i];
                     pdu += 3;
-                    add_accel_line(dev->logFile, &dev->logAccel);
+                    emit_accel(dev);
                 }
             } else {
-                GetBits gb;
-                cmpGetBitsInit(&gb, pdu);
+                int8 diffs[3 * 16];
+                int8 * diff = diffs;
+                cmpUnpack(pdu, 3 * field_count, nbits, diffs);
                 while (field_count--) {
-                    uint8 i;
-                    for (i = 0; i < 3; i++) {
-                        int8 diff = cmpGetBits(&gb, nbits);
-                        dev->logAccel.accel[i] = decode_accel(dev->logAccel.accel[i], diff, nbits);
+                    for (i = 0; i < 3; i++, diff++) {
+                        // A delta that does not overflow always fits its bits
+                        int accel = dev->logAccel.accel[i] + *diff;
+                        if (accel >= -128 && accel <= 127)
+                            dev->logAccel.accel[i] = accel;
+                        else
+                            dev->logAccel.accel[i] = decode_accel(dev->logAccel.accel[i], *diff, nbits);
                     }
-                    add_accel_line(dev->logFile, &dev->logAccel);
+                    emit_accel(dev);
                 }
             }
 
@@ -432,7 +354,7 @@ int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
 
         fflush(stdout);
         if (dev->read_logs >= dev->total_logs || dev->status.num_log_entries == 0)
-            dev->state = STATE_COUNT; // Done with command
+            download_done(dev); // Done with command
     }
 
     return 0;
@@ -461,7 +383,9 @@ void print_status(uint8_t status) {
 }
 
 // device status
-int process_status(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
+int process_status(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    if (status)
+        return 0;
     if (buflen < sizeof(WEDStatus))
         return -1;
     uint8_t * pdu = &buf[1];
@@ -494,8 +418,10 @@ int process_status(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
 }
 
 // Extended device status
-int process_extstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
+int process_extstatus(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
     dev->state = STATE_COUNT;
+    if (status)
+        return 0; // Error is already reported
     if (buflen < sizeof(WEDCurrentConfig) + 1)
         return -1;
     uint8_t * pdu = &buf[1];
@@ -536,8 +462,10 @@ int process_extstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
 }
 
 // i2c result
-int process_debug_i2c(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
+int process_debug_i2c(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
     dev->state = STATE_COUNT;
+    if (status)
+        return 0; // Error is already reported
     if (buflen < sizeof(WEDDebugI2CResult) + 1)
         return -1;
     uint8_t * pdu = &buf[1];
@@ -554,34 +482,164 @@ int process_debug_i2c(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
     return 0;
 }
 
-// State machine to get necessary information.
+// Characteristics discovery looks for
+#define DISCOVER_CHARS_MASK (((1u << AMIIGO_UUID_COUNT) - 1) & ~((1u << STD_UUID_CCC) | (1u << AMIIGO_UUID_SERVICE)))
+
+// Enumerate characteristics within a handle range
+static int discover_chars(amdev_t * dev, uint16_t start_handle, uint16_t end_handle) {
+    dev->disc_end = end_handle;
+    return trans_read_by_type(dev, start_handle, end_handle, GATT_CHARAC_UUID, process_handles);
+}
+
+// Amiigo service is looked up
+//  characteristics are then enumerated within the service only,
+//  or all the handles if the service cannot be found
+static int process_service(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    if (status == ATT_ECODE_TIMEOUT)
+        return 0;
+    // Each found service is its handle followed by its group end handle
+    if (status || buflen < 5) {
+        printf(" (Amiigo service not found, discovering all handles)\n");
+        return discover_chars(dev, OPT_START_HANDLE, OPT_END_HANDLE);
+    }
+    uint16_t start_handle = att_get_u16(&buf[1]);
+    uint16_t end_handle = att_get_u16(&buf[3]);
+    if (g_opt.verbosity)
+        printf(" (Amiigo service 0x%04x..0x%04x)\n", start_handle, end_handle);
+    return discover_chars(dev, start_handle, end_handle);
+}
+
+// Discover all the characteristics handles, then the device
+int discover_handles(amdev_t * dev) {
+    uint8_t value[16];
+    dev->handles = HANDLES_DISCOVERED;
+    dev->state = STATE_NONE;
+    dev->disc_found = 0;
+    att_put_uuid128(dev->chars[AMIIGO_UUID_SERVICE].uuid, value);
+    return trans_find_by_type(dev, OPT_START_HANDLE, OPT_END_HANDLE, GATT_PRIM_SVC_UUID,
+            value, sizeof(value), process_service);
+}
+
+static int discover_step(amdev_t * dev);
+
+// Keep the handles for the next connection
+//  only handles discovered on this connection go in the cache, default ones were never verified
+static void discover_cache_store(amdev_t * dev) {
+    if (dev->handles == HANDLES_DISCOVERED)
+        cache_store(g_cfg.dst[dev->dev_idx], &dev->ver, dev->chars, dev->szBuild);
+}
+
+// Firmware version is read
+// Inputs:
+//   pdu - version value
+// Outputs:
+//   returns 1 if the handles are to be discovered again
+static int discover_version(amdev_t * dev, const uint8_t * pdu) {
+    dev->ver.Major = pdu[0];
+    dev->ver.Minor = pdu[1];
+    dev->ver.Build = att_get_u16(&pdu[2]);
+    dev->ver_flat = FW_VERSION(dev->ver.Major, dev->ver.Minor, dev->ver.Build);
+    dev->ops = ops_select(dev->ver_flat);
+    sprintf(dev->szVersion, "%u.%u.%u%s", dev->ver.Major, dev->ver.Minor, dev->ver.Build,
+            dev->ver_flat < FW_VERSION(1,8,89) ? " (< 1.8.89: incompatible config)" : "");
+    if (dev->handles == HANDLES_CACHED && memcmp(&dev->ver, &dev->cache_ver, sizeof(WEDVersion)) != 0) {
+        // Handles may have moved with the firmware
+        printf(" (Firmware of %s changed, discovering handles)\n", g_cfg.dst[dev->dev_idx]);
+        cache_invalidate(g_cfg.dst[dev->dev_idx]);
+        dev->szBuild[0] = 0; // Cached build is of the old firmware
+        return 1;
+    }
+    return 0;
+}
+
+// Discovery read is answered
+static int process_discovery(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    if (status == ATT_ECODE_ATTR_NOT_FOUND)
+        return discover_step(dev); // Skip what the device does not have
+    if (status)
+        return 0;
+
+    switch (dev->state) {
+    case STATE_BUILD: {
+        // Value may be as long as the MTU allows, keep what fits
+        size_t len = buflen > 1 ? buflen - 1 : 0;
+        if (len > sizeof(dev->szBuild) - 1)
+            len = sizeof(dev->szBuild) - 1;
+        memcpy(dev->szBuild, &buf[1], len);
+        dev->szBuild[len] = 0;
+        break;
+    }
+    case STATE_VERSION:
+        if (buflen < 5)
+            return -1;
+        if (discover_version(dev, &buf[1]))
+            return discover_handles(dev);
+        discover_cache_store(dev);
+        break;
+    case STATE_STATUS:
+        return process_status(dev, status, buf, buflen);
+    default:
+        dump_buffer(buf, buflen);
+        return 0;
+    }
+    // More to discover
+    return discover_step(dev);
+}
+
+// Read multiple is answered
+//  version comes first, then either the status or the build text
+static int process_discovery_multi(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    if (status == ATT_ECODE_TIMEOUT)
+        return 0;
+    if (status || buflen < 5 || (dev->state == STATE_BUILD && buflen >= dev->mtu)) {
+        // Not supported by the device (or build text may be cut), read one by one
+        dev->state = STATE_NONE;
+        return discover_step(dev);
+    }
+    if (discover_version(dev, &buf[1]))
+        return discover_handles(dev);
+
+    if (dev->state == STATE_BUILD) {
+        memcpy(dev->szBuild, &buf[5], buflen - 5);
+        dev->szBuild[buflen - 5] = 0;
+        discover_cache_store(dev);
+        // Status is next
+        dev->state = STATE_VERSION;
+        return discover_step(dev);
+    }
+    // Status value follows the version, parse as if it was read alone
+    dev->state = STATE_STATUS;
+    return process_status(dev, 0, &buf[4], buflen - 4);
+}
+
+// State machine to get necessary information, one read at a time.
 // Discover device current status, and running firmware
-int discover_device(amdev_t * dev) {
+static int discover_step(amdev_t * dev) {
 
     uint16_t handle;
 
     DISCOVERY_STATE new_state = STATE_NONE;
     switch (dev->state) {
     case STATE_NONE:
-        handle = g_char[AMIIGO_UUID_BUILD].value_handle;
+        handle = dev->chars[AMIIGO_UUID_BUILD].value_handle;
         new_state = STATE_BUILD;
         if (handle == 0) {
             // Ignore information
             dev->state = new_state;
-            return discover_device(dev);
+            return discover_step(dev);
         }
         break;
     case STATE_BUILD:
-        handle = g_char[AMIIGO_UUID_VERSION].value_handle;
+        handle = dev->chars[AMIIGO_UUID_VERSION].value_handle;
         new_state = STATE_VERSION;
         if (handle == 0) {
             // Ignore information
             dev->state = new_state;
-            return discover_device(dev);
+            return discover_step(dev);
         }
         break;
     case STATE_VERSION:
-        handle = g_char[AMIIGO_UUID_STATUS].value_handle;
+        handle = dev->chars[AMIIGO_UUID_STATUS].value_handle;
         new_state = STATE_STATUS;
         if (handle == 0) {
             fprintf(stderr, "No device status to proceed!\n");
@@ -595,124 +653,143 @@ int discover_device(amdev_t * dev) {
     dev->state = new_state;
 
     // Read the handle of interest
-    int ret = exec_read(dev->sock, handle);
+    int ret = trans_read(dev, handle, process_discovery);
     return ret;
 }
 
+// Discover device current status, and running firmware
+//  with the build text known (cached for this firmware) version and status
+//  are read together, otherwise version and build are, then the status
+int discover_device(amdev_t * dev) {
+    uint16_t handles[2];
+    if (dev->state != STATE_NONE)
+        return discover_step(dev);
+
+    handles[0] = dev->chars[AMIIGO_UUID_VERSION].value_handle;
+    if (dev->handles == HANDLES_CACHED && dev->szBuild[0]) {
+        handles[1] = dev->chars[AMIIGO_UUID_STATUS].value_handle;
+        dev->state = STATE_STATUS;
+    } else {
+        handles[1] = dev->chars[AMIIGO_UUID_BUILD].value_handle;
+        dev->state = STATE_BUILD;
+    }
+    if (handles[0] == 0 || handles[1] == 0) {
+        dev->state = STATE_NONE;
+        return discover_step(dev);
+    }
+
+    return trans_read_multi(dev, handles, 2, process_discovery_multi);
+}
+
+// MTU exchange is answered
+int process_mtu(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    uint16_t mtu;
+    // Not supported by the device, keep the default
+    if (status)
+        return 0;
+    if (dec_mtu_resp(buf, buflen, &mtu) == 0)
+        return -1;
+    // Both ends must be able to receive it
+    if (mtu > ATT_MTU_MAX)
+        mtu = ATT_MTU_MAX;
+    if (mtu < ATT_DEFAULT_LE_MTU)
+        mtu = ATT_DEFAULT_LE_MTU;
+    dev->mtu = mtu;
+    if (g_opt.verbosity)
+        printf(" (MTU %u for %s)\n", mtu, g_cfg.dst[dev->dev_idx]);
+    return 0;
+}
+
+// Characteristics discovery (--full) is answered
+int process_handles(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    struct att_data_iter iter;
+    const uint8_t *value;
+    uint16_t handle = 0;
+    int j;
+
+    // No more characteristics, now discover the device
+    if (status == ATT_ECODE_ATTR_NOT_FOUND)
+        return discover_device(dev);
+    if (status)
+        return 0;
+
+    if (dec_read_by_type_resp_iter(buf, buflen, &iter) == 0 || (iter.len != 7 && iter.len != 21))
+        return -1;
+
+    while ((value = att_data_iter_next(&iter)) != NULL) {
+        bt_uuid_t uuid;
+
+        handle = att_get_u16(value);
+        if (iter.len == 7) {
+            bt_uuid_t uuid16 = att_get_uuid16(&value[5]);
+            bt_uuid_to_uuid128(&uuid16, &uuid);
+        } else {
+            uuid = att_get_uuid128(&value[5]);
+        }
+        uint8_t properties = value[2];
+        uint16_t value_handle = att_get_u16(&value[3]);
+        for (j = 0; j < AMIIGO_UUID_COUNT; ++j) {
+            if (bt_uuid_cmp(&uuid, &dev->chars[j].uuid) == 0) {
+                dev->chars[j].handle = handle;
+                dev->chars[j].properties = properties;
+                dev->chars[j].value_handle = value_handle;
+                dev->disc_found |= 1u << j;
+                break;
+            }
+        }
+        char str_uuid[MAX_LEN_UUID_STR + 1] = { 0 };
+        bt_uuid_to_string(&uuid, str_uuid, sizeof(str_uuid));
+        printf("handle: 0x%04x\t properties: 0x%04x\t value handle: 0x%04x\t UUID: %s \n",
+                handle, properties, value_handle, str_uuid);
+    } // end while (value
+
+    // Get the rest of handles, until all is found
+    if ((dev->disc_found & DISCOVER_CHARS_MASK) != DISCOVER_CHARS_MASK &&
+            handle != 0 && handle < dev->disc_end)
+        return trans_read_by_type(dev, handle + 1, dev->disc_end, GATT_CHARAC_UUID, process_handles);
+
+    return discover_device(dev);
+}
+
 //----------------------------------------------------------------------------------------
 // Process incoming raw data
+//  responses are handed to the request they answer
 int process_data(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
     int ret = 0;
-    struct att_data_list *list = NULL;
     uint16_t handle = 0;
     uint8_t err = ATT_ECODE_IO;
-    int i, j;
     switch (buf[0]) {
-    case ATT_OP_ERROR:
-        if (buflen > 4)
-            err = buf[4];
-        if (err == ATT_ECODE_ATTR_NOT_FOUND) {
-            // If no battery information, we do not have status
-            if (dev->status.battery_level == 0)
-                discover_device(dev);
-        } else {
-            if (buflen > 1)
-                handle = att_get_u16(&buf[1]);
-            fprintf(stderr, "Error (%s) on handle (0x%4.4x)\n",
-                    att_ecode2str(err), handle);
-        }
-        break;
     case ATT_OP_HANDLE_NOTIFY:
         // Proceed with download
         process_download(dev, buf, buflen);
         break;
-    case ATT_OP_READ_BY_TYPE_RESP:
-        list = dec_read_by_type_resp((uint8_t *) buf, buflen);
-        if (list == NULL)
+    case ATT_OP_ERROR:
+        if (buflen > 4)
+            err = buf[4];
+        if (dev->handles == HANDLES_CACHED &&
+                (err == ATT_ECODE_ATTR_NOT_FOUND || err == ATT_ECODE_INVALID_HANDLE)) {
+            // Cached handles are stale, discover them after reconnect
+            fprintf(stderr, "Cached handles of %s are stale\n", g_cfg.dst[dev->dev_idx]);
+            cache_invalidate(g_cfg.dst[dev->dev_idx]);
+            char_reset(dev->chars);
             return -1;
-
-        handle = 0;
-        for (i = 0; i < list->num; i++) {
-            uint8_t *value = list->data[i];
-            bt_uuid_t uuid;
-
-            handle = att_get_u16(value);
-            if (list->len == 7) {
-                bt_uuid_t uuid16 = att_get_uuid16(&value[5]);
-                bt_uuid_to_uuid128(&uuid16, &uuid);
-            } else {
-                uuid = att_get_uuid128(&value[5]);
-            }
-            uint8_t properties = value[2];
-            uint16_t value_handle = att_get_u16(&value[3]);
-            for (j = 0; j < AMIIGO_UUID_COUNT; ++j) {
-                if (bt_uuid_cmp(&uuid, &g_char[j].uuid) == 0) {
-                    g_char[j].handle = handle;
-                    g_char[j].properties = properties;
-                    g_char[j].value_handle = value_handle;
-                    break;
-                }
-            }
-            char str_uuid[MAX_LEN_UUID_STR + 1] = { 0 };
-            bt_uuid_to_string(&uuid, str_uuid, sizeof(str_uuid));
-            printf("handle: 0x%04x\t properties: 0x%04x\t value handle: 0x%04x\t UUID: %s \n",
-                    handle, properties, value_handle, str_uuid);
-        } // end for(i = 0
-
-        // Get the rest of handles
-        if (handle != 0 && (handle + 1) < OPT_END_HANDLE) {
-            discover_handles(dev->sock, handle + 1, OPT_END_HANDLE);
         }
-        break;
-    case ATT_OP_READ_RESP:
-        switch (dev->state) {
-        case STATE_BUILD:
-            strncpy(dev->szBuild, (const char *) &buf[1], buflen - 1);
-            // More to discover
-            discover_device(dev);
-            break;
-        case STATE_VERSION:
-            dev->ver.Major = buf[1];
-            dev->ver.Minor = buf[2];
-            dev->ver.Build = att_get_u16(&buf[3]);
-            dev->ver_flat = FW_VERSION(dev->ver.Major, dev->ver.Minor, dev->ver.Build);
-            sprintf(dev->szVersion, "%u.%u.%u%s", dev->ver.Major, dev->ver.Minor, dev->ver.Build,
-                    dev->ver_flat < FW_VERSION(1,8,89) ? " (< 1.8.89: incompatible config)" : "");
-            // More to discover
-            discover_device(dev);
-            break;
-        case STATE_STATUS:
-            process_status(dev, buf, buflen);
-            break;
-        case STATE_DOWNLOAD:
-            // This must be keep-alive
-            process_status(dev, buf, buflen);
-            break;
-        case STATE_FWSTATUS:
-        case STATE_FWSTATUS_WAIT:
-            // Act upon new firmware update status
-            ret = process_fwstatus(dev, buf, buflen);
-            break;
-        case STATE_I2C:
-            // i2c result
-            ret = process_debug_i2c(dev, buf, buflen);
-            break;
-        case STATE_EXTSTATUS:
-            // extended status result
-            ret = process_extstatus(dev, buf, buflen);
-            break;
-        default:
-            dump_buffer(buf, buflen);
-            break;
+        // Read multiple falls back to single reads, which report their own errors
+        if (err != ATT_ECODE_ATTR_NOT_FOUND && !(buflen > 1 && buf[1] == ATT_OP_READ_MULTI_REQ)) {
+            if (buflen > 3)
+                handle = att_get_u16(&buf[2]);
+            fprintf(stderr, "Error (%s) on handle (0x%4.4x)\n",
+                    att_ecode2str(err), handle);
         }
-        break;
+        // fall through
     default:
-        dump_buffer(buf, buflen);
+        ret = trans_response(dev, buf, buflen);
+        if (ret == TRANS_UNMATCHED) {
+            dump_buffer(buf, buflen);
+            ret = 0;
+        }
         break;
     }
 
-    if (list != NULL)
-        att_data_list_free(list);
-
     return ret;
 }
@@ -15,8 +15,17 @@
 #define OPT_START_HANDLE 0x0001
 #define OPT_END_HANDLE   0xffff
 
+void log_init(void);
+int discover_handles(amdev_t * dev);
 int discover_device(amdev_t * dev);
 int process_data(amdev_t * dev, uint8_t * buf, ssize_t buflen);
+int process_mtu(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+int process_handles(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+int process_status(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+int process_extstatus(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+int process_debug_i2c(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+int process_download_start(amdev_t * dev, uint8_t * buf, ssize_t buflen);
+int process_download(amdev_t * dev, uint8_t * buf, ssize_t buflen);
 void print_status(uint8_t status);
 
 #endif // include guard
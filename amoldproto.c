@@ -25,9 +25,9 @@
 #include "amcmd.h"
 
 // Start configuration of light sensors
-int exec_configls_18116(int sock) {
+int exec_configls_18116(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -44,7 +44,7 @@ int exec_configls_18116(int sock) {
     config.lightsensor.movement = g_cfg.config_ls.movement;
     config.lightsensor.flags = g_cfg.config_ls.flags;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.lightsensor));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.lightsensor));
     if (ret)
         return -1;
 
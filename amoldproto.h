@@ -57,7 +57,7 @@ typedef struct {
     };
 } PACKED WEDConfig_1816;
 
-int exec_configls_18116(int sock);
+int exec_configls_18116(amdev_t * dev);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,85 @@
+/*
+ * Amiigo Link protocol of each firmware generation
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  each firmware generation has its own decoders and encoders where the layouts differ,
+ *  a device picks its generation once the version is read, so nothing else checks the version
+ *  a new protocol revision is a new entry on top of the table
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "jni/bluetooth.h"
+#include "att.h"
+
+#include "common.h"
+#include "amidefs.h"
+#include "amproto.h"
+#include "amoldproto.h"
+#include "amops.h"
+
+// Light sensor entry before 1.8.84
+//  number of readings is in the top 2 bits of the first one
+static int ls_data_1883(const uint8_t * entry, int * len, amrecord_t * rec) {
+    int i;
+    uint16_t val16 = att_get_u16(&entry[1]);
+    uint8_t field_count = ((val16 & 0xC000) >> 14) + 1;
+    *len = 3 + sizeof(uint16) * (val16 >> 14);
+    if (field_count > 3)
+        return -1;
+    rec->ls_data.val[0] = val16 & 0x3FFF;
+    for (i = 1; i < field_count; ++i)
+        rec->ls_data.val[i] = att_get_u16(&entry[1 + i * 2]);
+    switch (field_count) {
+    case 1:
+        rec->ls_data.fields = RECORD_LS_IR;
+        break;
+    case 2:
+        rec->ls_data.fields = RECORD_LS_IR | RECORD_LS_OFF;
+        break;
+    default:
+        rec->ls_data.fields = RECORD_LS_RED | RECORD_LS_IR | RECORD_LS_OFF;
+        break;
+    }
+    return 0;
+}
+
+// Light sensor entry since 1.8.84
+//  bits 5, 6 and 7 of the type are the red, ir and off readings present
+static int ls_data(const uint8_t * entry, int * len, amrecord_t * rec) {
+    int i;
+    uint8_t fields = (entry[0] & 0xE0) >> 5;
+    uint8_t field_count = (fields & 1 ? 1 : 0) + (fields & 2 ? 1 : 0) + (fields & 4 ? 1 : 0);
+    *len = 1 + sizeof(uint16) * field_count;
+    for (i = 0; i < field_count; ++i)
+        rec->ls_data.val[i] = att_get_u16(&entry[1 + i * 2]);
+    rec->ls_data.fields = fields;
+    return 0;
+}
+
+// Firmware generations, newest first
+static const amops_t g_ops[] = {
+    { FW_VERSION(1,8,117), ls_data, exec_configls, exec_configconn },
+    { FW_VERSION(1,8,89), ls_data, exec_configls_18116, exec_configconn },
+    { FW_VERSION(1,8,84), ls_data, exec_configls_18116, NULL },
+    { 0, ls_data_1883, exec_configls_18116, NULL },
+};
+
+// Protocol of a firmware version
+// Inputs:
+//   ver_flat - flat firmware version (0 if not known yet)
+const amops_t * ops_select(unsigned int ver_flat) {
+    int i, count = sizeof(g_ops) / sizeof(g_ops[0]);
+    for (i = 0; i < count - 1; ++i) {
+        if (ver_flat >= g_ops[i].ver_flat)
+            break;
+    }
+    return &g_ops[i];
+}
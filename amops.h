@@ -0,0 +1,35 @@
+/*
+ * Amiigo Link protocol of each firmware generation
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMOPS_H
+#define AMOPS_H
+
+#include <stdint.h>
+
+#include "amdev.h"
+#include "amsink.h"
+
+// Decode a light sensor entry
+// Outputs:
+//   len - size of the entry in bytes
+//   rec - the record, if valid
+//   returns 0 if the record is valid, -1 if the entry is to be ignored
+typedef int (*ops_ls_data_t)(const uint8_t * entry, int * len, amrecord_t * rec);
+
+// Protocol of a firmware generation, chosen once the firmware version is known
+typedef struct _amops {
+    unsigned int ver_flat;            // First firmware version of this generation
+    ops_ls_data_t ls_data;            // Light sensor log entry decoder
+    int (*configls)(amdev_t * dev);   // Light sensor configuration
+    // Connection configuration (NULL if firmware does not take it)
+    int (*configconn)(amdev_t * dev, uint8_t conn_intr, uint16_t timeout);
+} amops_t;
+
+const amops_t * ops_select(unsigned int ver_flat);
+
+#endif // include guard
@@ -22,76 +22,77 @@
 #include "common.h"
 #include "gapproto.h"
 #include "amproto.h"
+#include "amtrans.h"
 #include "amchar.h"
 #include "amcmd.h"
 
 // Read the status (this is called also for keep-alive)
-int exec_status(int sock) {
+int exec_status(amdev_t * dev, trans_done_t done) {
     int ret;
 
-    uint16_t handle = g_char[AMIIGO_UUID_STATUS].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_STATUS].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
     // Now read for status
-    ret = exec_read(sock, handle);
+    ret = trans_read(dev, handle, done);
 
     return ret;
 }
 
 // Read the extended status
-int exec_extstatus(int sock) {
+int exec_extstatus(amdev_t * dev, trans_done_t done) {
     int ret;
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
     // Now read for status
-    ret = exec_read(sock, handle);
+    ret = trans_read(dev, handle, done);
 
     return ret;
 }
 
 // Start firmware update procedure
-int exec_fwupdate(int sock) {
+int exec_fwupdate(amdev_t * dev, trans_done_t done) {
     int ret;
 
-    uint16_t handle = g_char[AMIIGO_UUID_FIRMWARE].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_FIRMWARE].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
     printf("\nPreparing for update ...\n");
 
     // Now read for status
-    ret = exec_read(sock, handle);
+    ret = trans_read(dev, handle, done);
 
     return ret;
 }
 
 // Debug i2c by reading or writing register on given address
-int exec_debug_i2c(int sock) {
+int exec_debug_i2c(amdev_t * dev, trans_done_t done) {
     int ret;
 
-    uint16_t handle = g_char[AMIIGO_UUID_DEBUG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_DEBUG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
-    ret = exec_write(sock, handle, (uint8_t *) &g_cfg.i2c, sizeof(g_cfg.i2c));
+    ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &g_cfg.i2c, sizeof(g_cfg.i2c));
     if (ret)
         return -1;
 
     // Wait for it a little
     usleep(100);
-    ret = exec_read(sock, handle);
+    ret = trans_read(dev, handle, done);
 
     return ret;
 }
 
 // Start downloading the log packets
-int exec_download(int sock) {
+int exec_download(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
     printf("\n\n");
@@ -107,7 +108,7 @@ int exec_download(int sock) {
         config.log.flags |= WED_CONFIG_LOG_LOOPBACK;
 
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.log));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.log));
     if (ret)
         return -1;
 
@@ -115,9 +116,9 @@ int exec_download(int sock) {
 }
 
 // Start configuration of light sensors
-int exec_configls(int sock) {
+int exec_configls(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -126,7 +127,7 @@ int exec_configls(int sock) {
     config.config_type = WED_CFG_LS;
     config.lightsensor = g_cfg.config_ls;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.lightsensor));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.lightsensor));
     if (ret)
         return -1;
 
@@ -134,9 +135,9 @@ int exec_configls(int sock) {
 }
 
 // Start configuration of temperature sensor
-int exec_configtemp(int sock) {
+int exec_configtemp(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -145,7 +146,7 @@ int exec_configtemp(int sock) {
     config.config_type = WED_CFG_TEMP;
     config.temp = g_cfg.config_temp;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.accel));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.accel));
     if (ret)
         return -1;
 
@@ -153,9 +154,9 @@ int exec_configtemp(int sock) {
 }
 
 // Start configuration of accel sensors
-int exec_configaccel(int sock) {
+int exec_configaccel(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -164,7 +165,30 @@ int exec_configaccel(int sock) {
     config.config_type = WED_CFG_ACCEL;
     config.accel = g_cfg.config_accel;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.accel));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.accel));
+    if (ret)
+        return -1;
+
+    return 0;
+}
+
+// Ask for a connection interval, the device requests the connection update
+// Inputs:
+//   conn_intr - connection interval in 1.25ms units
+//   timeout   - supervision timeout in 10ms units
+int exec_configconn(amdev_t * dev, uint8_t conn_intr, uint16_t timeout) {
+
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
+    if (handle == 0)
+        return -1; // Not ready yet
+
+    WEDConfig config;
+    memset(&config, 0, sizeof(config));
+    config.config_type = WED_CFG_CONN;
+    config.conn.conn_intr = conn_intr;
+    config.conn.timeout = timeout;
+
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.conn));
     if (ret)
         return -1;
 
@@ -172,9 +196,9 @@ int exec_configaccel(int sock) {
 }
 
 // Switch accel log sequence mode (testing mode log accel count instead of accel values)
-int exec_test_seq(int sock) {
+int exec_test_seq(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -187,7 +211,7 @@ int exec_test_seq(int sock) {
     config.config_type = WED_CFG_MAINT;
     config.maint = config_maint;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
     if (ret)
         return -1;
 
@@ -195,9 +219,9 @@ int exec_test_seq(int sock) {
 }
 
 // Start LED blinking
-int exec_blink(int sock) {
+int exec_blink(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -210,7 +234,7 @@ int exec_blink(int sock) {
     config.config_type = WED_CFG_MAINT;
     config.maint = config_maint;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
     if (ret)
         return -1;
 
@@ -218,9 +242,9 @@ int exec_blink(int sock) {
 }
 
 // Go to deep sleep until hard double tap
-int exec_deepsleep(int sock) {
+int exec_deepsleep(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -232,7 +256,7 @@ int exec_deepsleep(int sock) {
     config.config_type = WED_CFG_MAINT;
     config.maint = config_maint;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
     if (ret)
         return -1;
 
@@ -240,9 +264,9 @@ int exec_deepsleep(int sock) {
 }
 
 // Start LED blinking
-int exec_tag(int sock) {
+int exec_tag(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -261,7 +285,7 @@ int exec_tag(int sock) {
         printf("Time tag %u\n", tag);
     }
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.general));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.general));
     if (ret)
         return -1;
 
@@ -269,9 +293,9 @@ int exec_tag(int sock) {
 }
 
 // Rename the WED
-int exec_rename(int sock) {
+int exec_rename(amdev_t * dev) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
 
@@ -285,7 +309,7 @@ int exec_rename(int sock) {
     for (i = strlen(config.name.name); i < DEV_NAME_LEN; ++i)
         config.name.name[i] = ' ';
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.name));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.name));
     if (ret)
         return -1;
 
@@ -293,9 +317,9 @@ int exec_rename(int sock) {
 }
 
 // Reset config, or CPU or log buffer
-int exec_reset(int sock, AMIIGO_CMD cmd) {
+int exec_reset(amdev_t * dev, AMIIGO_CMD cmd) {
 
-    uint16_t handle = g_char[AMIIGO_UUID_CONFIG].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_CONFIG].value_handle;
     if (handle == 0)
         return -1; // Not ready yet
     WEDConfigMaint config_maint;
@@ -322,7 +346,7 @@ int exec_reset(int sock, AMIIGO_CMD cmd) {
     config.config_type = WED_CFG_MAINT;
     config.maint = config_maint;
 
-    int ret = exec_write(sock, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
+    int ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &config, sizeof(config.config_type) + sizeof(config.maint));
     if (ret)
         return -1;
 
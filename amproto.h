@@ -10,21 +10,22 @@
 #define AMPROTO_H
 
 #include "amcmd.h"
+#include "amtrans.h"
 
-int exec_status(int sock);
-int exec_extstatus(int sock);
-int exec_fwupdate(int sock);
-int exec_debug_i2c(int sock);
-int exec_download(int sock);
-int exec_configls(int sock);
-int exec_configaccel(int sock);
-int exec_configtemp(int sock);
-int exec_test_seq(int sock);
-int exec_blink(int sock);
-int exec_deepsleep(int sock);
-int exec_tag(int sock);
-int exec_rename(int sock);
-int exec_reset(int sock, AMIIGO_CMD cmd);
-int discover_handles(int sock, uint16_t start_handle, uint16_t end_handle);
+int exec_status(amdev_t * dev, trans_done_t done);
+int exec_extstatus(amdev_t * dev, trans_done_t done);
+int exec_fwupdate(amdev_t * dev, trans_done_t done);
+int exec_debug_i2c(amdev_t * dev, trans_done_t done);
+int exec_download(amdev_t * dev);
+int exec_configls(amdev_t * dev);
+int exec_configaccel(amdev_t * dev);
+int exec_configtemp(amdev_t * dev);
+int exec_configconn(amdev_t * dev, uint8_t conn_intr, uint16_t timeout);
+int exec_test_seq(amdev_t * dev);
+int exec_blink(amdev_t * dev);
+int exec_deepsleep(amdev_t * dev);
+int exec_tag(amdev_t * dev);
+int exec_rename(amdev_t * dev);
+int exec_reset(amdev_t * dev, AMIIGO_CMD cmd);
 
 #endif // include guard
@@ -0,0 +1,103 @@
+/*
+ * Amiigo Link single-producer single-consumer PDU ring
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  each entry is a 16-bit length followed by the data, wrapped around the end
+ *  head and tail run freely and are masked on access, so no lock is needed
+ *  as long as only one thread pushes and only one thread pops
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "amring.h"
+
+#define RING_HDR_SIZE 2 // Entry length prefix
+
+// Allocate the ring storage
+// Inputs:
+//   size - storage size in bytes, must be a power of two
+int ring_init(amring_t * ring, uint32_t size) {
+    memset(ring, 0, sizeof(*ring));
+    if (size == 0 || (size & (size - 1)) != 0)
+        return -1;
+    ring->buf = malloc(size);
+    if (ring->buf == NULL)
+        return -1;
+    ring->size = size;
+    return 0;
+}
+
+// Release the ring storage
+void ring_free(amring_t * ring) {
+    free(ring->buf);
+    ring->buf = NULL;
+    ring->size = 0;
+}
+
+// Copy into the ring at a free running position
+static void ring_write(amring_t * ring, uint32_t pos, const uint8_t * data, uint32_t len) {
+    uint32_t off = pos & (ring->size - 1);
+    uint32_t first = ring->size - off;
+    if (first > len)
+        first = len;
+    memcpy(&ring->buf[off], data, first);
+    memcpy(&ring->buf[0], data + first, len - first);
+}
+
+// Copy out of the ring at a free running position
+static void ring_read(const amring_t * ring, uint32_t pos, uint8_t * data, uint32_t len) {
+    uint32_t off = pos & (ring->size - 1);
+    uint32_t first = ring->size - off;
+    if (first > len)
+        first = len;
+    memcpy(data, &ring->buf[off], first);
+    memcpy(data + first, &ring->buf[0], len - first);
+}
+
+// Queue an entry (producer thread only)
+// Outputs:
+//   returns 0 on success, -1 if the ring is full and the entry is dropped
+int ring_push(amring_t * ring, const uint8_t * data, uint16_t len) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t used = head - tail;
+    if (used + RING_HDR_SIZE + len > ring->size) {
+        ring->overflows++;
+        return -1;
+    }
+    uint8_t hdr[RING_HDR_SIZE] = {len & 0xFF, len >> 8};
+    ring_write(ring, head, hdr, RING_HDR_SIZE);
+    ring_write(ring, head + RING_HDR_SIZE, data, len);
+    used += RING_HDR_SIZE + len;
+    if (used > ring->peak)
+        ring->peak = used;
+    // Publish the entry
+    __atomic_store_n(&ring->head, head + RING_HDR_SIZE + len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Take the oldest entry (consumer thread only)
+// Outputs:
+//   returns length of the entry, or -1 if the ring is empty
+int ring_pop(amring_t * ring, uint8_t * data, uint16_t maxlen) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return -1;
+    uint8_t hdr[RING_HDR_SIZE];
+    ring_read(ring, tail, hdr, RING_HDR_SIZE);
+    uint16_t len = hdr[0] | (hdr[1] << 8);
+    uint16_t copy = len < maxlen ? len : maxlen;
+    ring_read(ring, tail + RING_HDR_SIZE, data, copy);
+    // Free the entry
+    __atomic_store_n(&ring->tail, tail + RING_HDR_SIZE + len, __ATOMIC_RELEASE);
+    return copy;
+}
@@ -0,0 +1,34 @@
+/*
+ * Amiigo Link single-producer single-consumer PDU ring
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMRING_H
+#define AMRING_H
+
+#include <stdint.h>
+
+// Ring of variable size entries, one thread pushes and another one pops
+typedef struct _amring {
+    uint8_t * buf;          // Ring storage
+    uint32_t size;          // Size of storage in bytes (power of two)
+    uint32_t head;          // Bytes pushed so far (producer)
+    uint32_t tail;          // Bytes popped so far (consumer)
+    uint32_t peak;          // Most bytes queued at once (producer)
+    uint32_t overflows;     // Entries dropped because the ring was full (producer)
+} amring_t;
+
+int ring_init(amring_t * ring, uint32_t size);
+void ring_free(amring_t * ring);
+int ring_push(amring_t * ring, const uint8_t * data, uint16_t len);
+int ring_pop(amring_t * ring, uint8_t * data, uint16_t maxlen);
+
+// Bytes queued in the ring
+static inline uint32_t ring_count(amring_t * ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif // include guard
@@ -0,0 +1,1492 @@
+/*
+ * Amiigo Link device session (one I/O thread per adapter)
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "jni/bluetooth.h"
+#include "att.h"
+
+#include "amidefs.h"
+#include "amdev.h"
+#include "common.h"
+#include "gapproto.h"
+#include "amproto.h"
+#include "amlprocess.h"
+#include "amsession.h"
+#include "fwupdate.h"
+#include "amsink.h"
+#include "amops.h"
+#include "amctl.h"
+#include "amtrans.h"
+#include "amcache.h"
+#include "hcitool.h"
+
+#define CONNECT_TIMEOUT_MS 5000 // Time to wait for each device to connect
+#define WL_CONNECT_TIMEOUT_MS 30000 // Time to wait for a device to advertise, when connecting through the whitelist
+#define WL_SCAN_INTERVAL 0x0030 // Scan interval while connecting through the whitelist (0.625ms units)
+#define WL_SCAN_WINDOW 0x0030   // Scan window while connecting through the whitelist (0.625ms units)
+#define WL_CONN_INTR_MIN 0x0018 // Initial connection interval range (1.25ms units)
+#define WL_CONN_INTR_MAX 0x0028
+#define KEEPALIVE_MS 60000 // Keep-alive by reading status this often
+#define DOWNLOAD_TIMEOUT_MS 2000 // Download ends if no packet comes in this time
+#define RECONNECT_MIN_MS 1000 // First reconnect delay after a device is lost, doubled each retry
+#define RECONNECT_MAX_MS 30000 // Longest reconnect delay
+#define MAX_RECONNECTS 5 // Device fails after this many reconnects in a row
+#define SESSION_MAX_EVENTS 64 // Most device events to handle per wakeup
+#define URING_ENTRIES 64 // Submission queue size of the io_uring backend
+#define URING_RX_BUFS 256 // Receive buffers shared by the devices of a session (io_uring backend)
+
+// io_uring completion tag of the receive of a device
+#define RX_USER_DATA(dev) (((uint64_t)(dev)->rx_tag << 32) | (uint32_t)(dev)->dev_idx)
+
+volatile int g_running_sessions = 0; // Sessions with their I/O thread still running
+
+// Wake up the decode thread if it is waiting for notifications
+static void session_wake_decoder(amsession_t * session) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&session->dec_idle, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t val = 1;
+        if (write(session->dec_fd, &val, sizeof(val)) != sizeof(val))
+            fprintf(stderr, "eventfd write error (%d) for %s\n", errno, session->src);
+    }
+}
+
+// Queue the start of a download for the decode thread, ahead of its notifications
+static int session_download_start(amdev_t * dev) {
+    uint8_t entry[DECODE_START_SIZE];
+    dev->dl_gen++;
+    entry[0] = DECODE_START;
+    att_put_u32(dev->dl_gen, &entry[1]);
+    att_put_u32(dev->status.num_log_entries, &entry[5]); // How many logs to download
+    entry[9] = dev->relinked;
+    dev->relinked = 0;
+    if (ring_push(&dev->ring, entry, sizeof(entry)))
+        return -1;
+    session_wake_decoder(dev->session);
+    return 0;
+}
+
+// Switch the connection interval of a device
+//  the adapter updates the connection if it can, otherwise the device is asked to
+// Inputs:
+//   conn_intr - connection interval in 1.25ms units
+static int session_conn_interval(amdev_t * dev, uint8_t conn_intr) {
+    if (dev->session->hci >= 0 && dev->conn_handle != 0)
+        return le_conn_update(dev->session->hci, dev->conn_handle, conn_intr, CONN_TIMEOUT);
+    if (dev->ops->configconn == NULL)
+        return -1; // Incompatible config
+    // The device takes the request without confirming it, and only the adapter reports the outcome
+    printf(" (Asking %s for %.2f ms connection interval, interval in effect unknown)\n", g_cfg.dst[dev->dev_idx],
+            conn_intr * 1.25);
+    dev->conn_intr = 0;
+    return dev->ops->configconn(dev, conn_intr, CONN_TIMEOUT);
+}
+
+// Execute the requested command
+static int exec_command(amdev_t * dev) {
+    dev->started = 1;
+    switch (dev->cmd) {
+    case AMIIGO_CMD_NONE:
+        dev->state = STATE_COUNT; // Done with command
+        break;
+    case AMIIGO_CMD_DOWNLOAD:
+        if (dev->status.num_log_entries == 0 && !g_opt.live) {
+            // Nothing to download!
+            dev->state = STATE_COUNT; // Done with command
+            return 0;
+        }
+
+        dev->state = STATE_DOWNLOAD; // Download in progress
+        if (session_download_start(dev))
+            return -1;
+        if (!g_opt.live) {
+            dev->download_time = timer_now_ms();
+            timer_set(dev->sched, &dev->timers[TIMER_DOWNLOAD], dev->download_time + DOWNLOAD_TIMEOUT_MS);
+        }
+        // Shortest interval while downloading
+        if (g_opt.fast && !dev->conn_fast) {
+            if (session_conn_interval(dev, CONN_INTR_FAST) == 0)
+                dev->conn_fast = 1;
+            else
+                fprintf(stderr, "Cannot switch %s to the fast connection interval\n", g_cfg.dst[dev->dev_idx]);
+        }
+        return exec_download(dev);
+        break;
+    case AMIIGO_CMD_CONFIGLS:
+        dev->state = STATE_COUNT; // Done with command
+        return dev->ops->configls(dev);
+        break;
+    case AMIIGO_CMD_CONFIGACCEL:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_configaccel(dev);
+        break;
+    case AMIIGO_CMD_CONFIGTEMP:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_configtemp(dev);
+        break;
+    case AMIIGO_CMD_BLINK:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_blink(dev);
+        break;
+    case AMIIGO_CMD_DEEPSLEEP:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_deepsleep(dev);
+        break;
+    case AMIIGO_CMD_RESET_CPU:
+    case AMIIGO_CMD_RESET_LOGS:
+    case AMIIGO_CMD_RESET_CONFIGS:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_reset(dev, dev->cmd);
+        break;
+    case AMIIGO_CMD_FWUPDATE:
+        dev->state = STATE_FWSTATUS;
+        return exec_fwupdate(dev, process_fwstatus);
+        break;
+    case AMIIGO_CMD_I2C_READ:
+    case AMIIGO_CMD_I2C_WRITE:
+        dev->state = STATE_I2C;
+        return exec_debug_i2c(dev, process_debug_i2c);
+        break;
+    case AMIIGO_CMD_RENAME:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_rename(dev);
+        break;
+    case AMIIGO_CMD_TAG:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_tag(dev);
+        break;
+    case AMIIGO_CMD_TEST_SEQ:
+        dev->state = STATE_COUNT; // Done with command
+        return exec_test_seq(dev);
+        break;
+    case AMIIGO_CMD_EXTSTATUS:
+        dev->state = STATE_EXTSTATUS;
+        return exec_extstatus(dev, process_extstatus);
+        break;
+    default:
+        return 0;
+        break;
+    }
+    return 0;
+}
+
+// Start discovery on a device that just connected
+static int start_discovery(amdev_t * dev) {
+    int ret;
+    // Handles found before save the discovery, until the firmware changes
+    dev->szBuild[0] = 0;
+    if (cache_lookup(g_cfg.dst[dev->dev_idx], dev->chars, &dev->cache_ver, dev->szBuild, CACHE_BUILD_LEN) == 0)
+        dev->handles = HANDLES_CACHED;
+    else
+        dev->handles = HANDLES_DEFAULT;
+    if (g_opt.full && dev->handles != HANDLES_CACHED) {
+        // Start by discovering Amiigo handles
+        ret = discover_handles(dev);
+        if (ret) {
+            fprintf(stderr, "discover_handles() error %d in %s\n", ret, g_cfg.dst[dev->dev_idx]);
+            return -1;
+        }
+    } else {
+        // Use default (or cached) handles and discover the device
+        ret = discover_device(dev);
+        if (ret) {
+            fprintf(stderr, "discover_device() error %d in %s\n", ret, g_cfg.dst[dev->dev_idx]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Send the reply line and close the control client
+static void session_send_reply(int fd, int dev_idx, const char * szReply, int len) {
+    int ret = len > 0 ? (int)write(fd, szReply, len) : len;
+    if (ret != len) {
+        if (ret < 0 && errno == EPIPE)
+            fprintf(stderr, "Control client of %s is gone\n", g_cfg.dst[dev_idx]);
+        else
+            fprintf(stderr, "Could not reply to the control client of %s\n", g_cfg.dst[dev_idx]);
+    }
+    close(fd);
+}
+
+// Reply with an error to a control client
+static void session_reply_error(int fd, int dev_idx, const char * szError) {
+    char szReply[1024];
+    int len = snprintf(szReply, sizeof(szReply), "error %s %s\n", g_cfg.dst[dev_idx], szError);
+    if (len > (int)sizeof(szReply) - 1)
+        len = sizeof(szReply) - 1;
+    session_send_reply(fd, dev_idx, szReply, len);
+}
+
+// Reply to the control client waiting on the device, if any
+// Inputs:
+//   szError - error to report, or NULL if the command finished
+static void session_reply(amdev_t * dev, const char * szError) {
+    if (dev->req_fd < 0)
+        return;
+    if (szError != NULL) {
+        session_reply_error(dev->req_fd, dev->dev_idx, szError);
+    } else {
+        char szReply[1024];
+        int len = snprintf(szReply, sizeof(szReply), "ok %s Build: %s Version: %s Logs: %u Battery: %u%% Status: 0x%02x\n",
+                g_cfg.dst[dev->dev_idx], dev->szBuild, dev->szVersion,
+                dev->status.num_log_entries, dev->status.battery_level, dev->status.status);
+        if (len > (int)sizeof(szReply) - 1)
+            len = sizeof(szReply) - 1;
+        session_send_reply(dev->req_fd, dev->dev_idx, szReply, len);
+    }
+    dev->req_fd = -1;
+}
+
+// The command of a device finished, in daemon mode
+//  the control client gets its reply here, once, and the connection is kept warm for the next request
+static void session_command_done(amdev_t * dev) {
+    session_reply(dev, NULL);
+    dev->state = STATE_IDLE;
+    dev->idle_time = timer_now_ms();
+    // Not run again if the link drops
+    dev->cmd = AMIIGO_CMD_NONE;
+    dev->cmd_done = 1;
+    dev->retries = 0;
+}
+
+// Close the connection of a device and cancel its deadlines
+static void device_disconnect(amdev_t * dev) {
+    if (dev->rx_tag) {
+        uring_cancel(&dev->session->rx_ring, RX_USER_DATA(dev));
+        dev->rx_tag = 0;
+    }
+    if (dev->sock >= 0) {
+        // Closing the socket also removes it from the epoll set
+        gap_shutdown(dev->sock);
+        dev->sock = -1;
+    }
+    dev->tx_wait = 0;
+    if (dev->wl_wait) {
+        dev->wl_wait = 0;
+        dev->session->wl_dirty = 1;
+    }
+    // Requests are never answered on a closed link
+    trans_clear(dev);
+    int i;
+    for (i = 0; i < TIMER_COUNT; ++i)
+        timer_cancel(dev->sched, &dev->timers[i]);
+}
+
+// Report a device failure and take it out of the session
+static void device_failed(amdev_t * dev, const char * szReason) {
+    fprintf(stderr, "Device %s failed (%s)\n", g_cfg.dst[dev->dev_idx], szReason);
+    device_disconnect(dev);
+    dev->failed = 1;
+    dev->state = STATE_COUNT;
+}
+
+// Drop the connection of a device and reconnect after a backoff
+//  other devices of the session are not affected
+static void device_lost(amdev_t * dev, const char * szReason) {
+    // Command finished before the link dropped, its client is not kept waiting for the reconnect
+    if (dev->state == STATE_COUNT && !dev->failed) {
+        if (g_opt.ctl_path == NULL) {
+            // Nothing left to do on the device, the session releases it
+            device_disconnect(dev);
+            return;
+        }
+        session_command_done(dev);
+    }
+    if (dev->retries >= MAX_RECONNECTS) {
+        device_failed(dev, szReason);
+        return;
+    }
+    uint64_t delay = (uint64_t)RECONNECT_MIN_MS << dev->retries;
+    if (delay > RECONNECT_MAX_MS)
+        delay = RECONNECT_MAX_MS;
+    dev->retries++;
+    fprintf(stderr, "Device %s lost (%s), reconnecting in %u ms\n", g_cfg.dst[dev->dev_idx], szReason,
+            (unsigned int)delay);
+    device_disconnect(dev);
+
+    // Status and decoder state must be fresh after reconnect, the log file is kept
+    dev->state = STATE_RECONNECT;
+    dev->started = 0;
+    dev->status.battery_level = 0;
+    dev->relinked = 1;
+    if (timer_set(dev->sched, &dev->timers[TIMER_RECONNECT], timer_now_ms() + delay))
+        device_failed(dev, "timer");
+}
+
+// Find an active device of the session, or NULL if not connecting or connected
+static amdev_t * session_find_device(amsession_t * session, int dev_idx) {
+    int i;
+    for (i = 0; i < session->active_count; ++i) {
+        if (session->active[i]->dev_idx == dev_idx)
+            return session->active[i];
+    }
+    return NULL;
+}
+
+// Connect the socket of a device, the link may be already created through the whitelist
+static void session_connect_direct(amsession_t * session, amdev_t * dev) {
+    dev->sock = gap_connect_start(session->src, g_cfg.dst[dev->dev_idx]);
+    if (dev->sock < 0) {
+        device_lost(dev, "connect");
+        return;
+    }
+    // Connection is established once the socket is writable
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = dev;
+    if (epoll_ctl(session->efd, EPOLL_CTL_ADD, dev->sock, &ev) < 0) {
+        fprintf(stderr, "epoll_ctl() error (%d) in %s\n", errno, g_cfg.dst[dev->dev_idx]);
+        device_failed(dev, "epoll");
+    }
+}
+
+// Start connecting to a device of the session
+static void session_connect_device(amsession_t * session, amdev_t * dev) {
+    dev->state = STATE_CONNECTING;
+    if (g_opt.whitelist && session->hci >= 0 && !session->wl_failed) {
+        // Adapter connects as soon as the device advertises
+        if (timer_set(dev->sched, &dev->timers[TIMER_CONNECT], timer_now_ms() + WL_CONNECT_TIMEOUT_MS)) {
+            device_failed(dev, "timer");
+            return;
+        }
+        dev->wl_wait = 1;
+        session->wl_dirty = 1;
+        return;
+    }
+    // Timing of connection
+    if (timer_set(dev->sched, &dev->timers[TIMER_CONNECT], timer_now_ms() + CONNECT_TIMEOUT_MS)) {
+        device_failed(dev, "timer");
+        return;
+    }
+    session_connect_direct(session, dev);
+}
+
+// Stop using the whitelist, devices waiting for it connect directly
+static void session_wl_fail(amsession_t * session, const char * szReason) {
+    int i;
+    fprintf(stderr, "Cannot connect through the whitelist of %s (%s), connecting directly\n",
+            session->src, szReason);
+    session->wl_failed = 1;
+    session->wl_pending = 0;
+    session->wl_cancel = 0;
+    session->wl_step = WL_STEP_NONE;
+    for (i = 0; i < session->active_count; ++i) {
+        amdev_t * dev = session->active[i];
+        if (!dev->wl_wait)
+            continue;
+        dev->wl_wait = 0;
+        timer_set(dev->sched, &dev->timers[TIMER_CONNECT], timer_now_ms() + CONNECT_TIMEOUT_MS);
+        session_connect_direct(session, dev);
+    }
+}
+
+// Put the devices waiting for the adapter in its whitelist, then have it connect to them
+//  whitelist commands complete as events of the adapter (session_wl_command), nothing waits here
+static void session_wl_sync(amsession_t * session) {
+    bdaddr_t addr;
+    int i;
+    if (!session->wl_dirty || session->hci < 0 || session->wl_failed || session->wl_step != WL_STEP_NONE)
+        return;
+    if (session->wl_pending) {
+        // Whitelist cannot change while connecting, cancel first
+        if (!session->wl_cancel && le_conn_cancel(session->hci) == 0)
+            session->wl_cancel = 1;
+        return;
+    }
+    session->wl_dirty = 0;
+    session->wl_count = 0;
+    for (i = 0; i < session->active_count; ++i) {
+        amdev_t * dev = session->active[i];
+        if (dev->wl_wait && str2ba(g_cfg.dst[dev->dev_idx], &addr) == 0)
+            session->wl_idx[session->wl_count++] = dev->dev_idx;
+    }
+    if (session->wl_count == 0)
+        return;
+    // Size is read once, then the whitelist is emptied and filled each round
+    if (session->wl_size == 0) {
+        if (le_wl_read_size(session->hci) < 0) {
+            session_wl_fail(session, "whitelist");
+            return;
+        }
+        session->wl_step = WL_STEP_SIZE;
+    } else {
+        if (le_wl_clear(session->hci) < 0) {
+            session_wl_fail(session, "whitelist");
+            return;
+        }
+        session->wl_step = WL_STEP_CLEAR;
+    }
+}
+
+// A whitelist command is complete, send the next one or start connecting
+static void session_wl_command(amsession_t * session, const le_conn_evt_t * evt) {
+    bdaddr_t addr;
+    if ((evt->type == LE_EVT_WL_SIZE && session->wl_step != WL_STEP_SIZE) ||
+            (evt->type == LE_EVT_WL_CLEARED && session->wl_step != WL_STEP_CLEAR) ||
+            (evt->type == LE_EVT_WL_ADDED && session->wl_step != WL_STEP_ADD))
+        return; // Not waited for, may be of another user of the adapter
+    if (evt->status) {
+        // Devices already in are enough to connect to
+        if (evt->type != LE_EVT_WL_ADDED || session->wl_added == 0) {
+            session_wl_fail(session, "whitelist");
+            return;
+        }
+        session->wl_count = session->wl_added;
+    }
+    switch (evt->type) {
+    case LE_EVT_WL_SIZE:
+        if (evt->wl_size == 0 || le_wl_clear(session->hci) < 0) {
+            session_wl_fail(session, "whitelist");
+            return;
+        }
+        session->wl_size = evt->wl_size;
+        session->wl_step = WL_STEP_CLEAR;
+        return;
+    case LE_EVT_WL_CLEARED:
+        session->wl_added = 0;
+        break;
+    default:
+        if (evt->status == 0)
+            session->wl_added++;
+        break;
+    }
+    // Those that do not fit wait for the next round
+    if (session->wl_added < session->wl_count && session->wl_added < session->wl_size) {
+        if (str2ba(g_cfg.dst[session->wl_idx[session->wl_added]], &addr) || le_wl_add(session->hci, &addr) < 0) {
+            session_wl_fail(session, "whitelist");
+            return;
+        }
+        session->wl_step = WL_STEP_ADD;
+        return;
+    }
+    session->wl_step = WL_STEP_NONE;
+    if (session->wl_dirty)
+        return; // Waiting devices changed meanwhile, load again
+    if (le_conn_create(session->hci, WL_SCAN_INTERVAL, WL_SCAN_WINDOW,
+            WL_CONN_INTR_MIN, WL_CONN_INTR_MAX, CONN_TIMEOUT) < 0) {
+        session_wl_fail(session, "create connection");
+        return;
+    }
+    session->wl_pending = 1;
+}
+
+// Allocate a device of the session and start connecting to it
+// Inputs:
+//   dev_idx - device index in g_cfg.dst
+//   cmd     - command to execute once connected
+//   req_fd  - control client to reply to (-1 if none)
+static int session_open_device(amsession_t * session, int dev_idx, AMIIGO_CMD cmd, int req_fd) {
+    int i;
+    amdev_t * dev = calloc(1, sizeof(amdev_t));
+    if (dev == NULL) {
+        fprintf(stderr, "Not enough memory for device %s\n", g_cfg.dst[dev_idx]);
+        if (req_fd >= 0)
+            close(req_fd);
+        return -1;
+    }
+    if (ring_init(&dev->ring, RX_RING_SIZE) || trans_init(dev)) {
+        fprintf(stderr, "Not enough memory for device %s\n", g_cfg.dst[dev_idx]);
+        ring_free(&dev->ring);
+        free(dev);
+        if (req_fd >= 0)
+            close(req_fd);
+        return -1;
+    }
+    dev->dev_idx = dev_idx; // Keep the index for reference
+    char_reset(dev->chars);
+    dev->ops = ops_select(0); // Until the firmware version is read
+    dev->cmd = cmd;
+    dev->req_fd = req_fd;
+    dev->session = session;
+    pthread_mutex_lock(&session->dec_lock);
+    session->active[session->active_count++] = dev;
+    pthread_mutex_unlock(&session->dec_lock);
+    dev->sched = &session->timers;
+    for (i = 0; i < TIMER_COUNT; ++i)
+        timer_init(&dev->timers[i], i, dev);
+    dev->sock = -1;
+
+    session_connect_device(session, dev);
+    return 0;
+}
+
+// Decode all the notifications queued for a device
+// Outputs:
+//   returns number of entries decoded
+static int session_decode(amdev_t * dev) {
+    uint8_t pdu[RX_PDU_MAX];
+    int len, count = 0;
+    while ((len = ring_pop(&dev->ring, pdu, sizeof(pdu))) >= 0) {
+        count++;
+        if (len > 0 && pdu[0] == DECODE_START)
+            process_download_start(dev, pdu, len);
+        else if (dev->dec_gen == 0 || dev->done_gen != dev->dec_gen)
+            process_download(dev, pdu, len);
+        // else notifications past the end of the download are ignored
+    }
+    if (count)
+        g_sink->flush(dev);
+    return count;
+}
+
+// Finish a device the session is done with: decode what is left, close its log and release it
+static void decode_close_device(amdev_t * dev) {
+    session_decode(dev);
+    if (dev->ring.overflows || g_opt.verbosity)
+        printf(" (Decode ring %s: peak %u of %u bytes, %u dropped)\n", g_cfg.dst[dev->dev_idx],
+                dev->ring.peak, dev->ring.size, dev->ring.overflows);
+
+    // Close log files
+    g_sink->close(dev);
+
+    ring_free(&dev->ring);
+    free(dev);
+}
+
+// Decode and output thread of an adapter session
+//  file and console output happen here, so they do not hold off socket draining
+//  dec_lock is only held to look at the devices, never while decoding or writing:
+//  devices closed meanwhile are handed over through dec_closing and released here
+static void * decode_thread(void * arg) {
+    amsession_t * session = arg;
+    amdev_t ** devs = session->dec_active;
+    int i;
+    for (;;) {
+        int decoded = 0, done = 0, queued = 0, count;
+        pthread_mutex_lock(&session->dec_lock);
+        count = session->active_count;
+        memcpy(devs, session->active, count * sizeof(amdev_t *));
+        amdev_t * closing = session->dec_closing;
+        session->dec_closing = NULL;
+        session->dec_closing_tail = &session->dec_closing;
+        pthread_mutex_unlock(&session->dec_lock);
+
+        for (i = 0; i < count; ++i) {
+            amdev_t * dev = devs[i];
+            uint32_t done_gen = dev->done_gen;
+            decoded += session_decode(dev);
+            if (dev->done_gen != done_gen)
+                done = 1;
+        }
+        while (closing != NULL) {
+            amdev_t * dev = closing;
+            closing = dev->dec_next;
+            decode_close_device(dev);
+            decoded++;
+        }
+        // Handle cache is written here, off the session I/O thread
+        cache_flush();
+        if (session->uring && decoded) {
+            // Log writes of all the devices go in together
+            uring_submit(&session->log_ring, 0);
+            uring_reap(&session->log_ring);
+        }
+        if (done) {
+            // Let the session release the devices that are done
+            uint64_t val = 1;
+            if (write(session->done_fd, &val, sizeof(val)) != sizeof(val))
+                fprintf(stderr, "eventfd write error (%d) for %s\n", errno, session->src);
+        }
+        if (decoded)
+            continue;
+
+        // Announce going idle, then look again so a push in between is not missed
+        __atomic_store_n(&session->dec_idle, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&session->dec_lock);
+        for (i = 0; i < session->active_count; ++i) {
+            if (ring_count(&session->active[i]->ring))
+                queued = 1;
+        }
+        if (session->dec_closing != NULL || cache_dirty())
+            queued = 1;
+        pthread_mutex_unlock(&session->dec_lock);
+        if (queued) {
+            __atomic_store_n(&session->dec_idle, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if (__atomic_load_n(&session->dec_quit, __ATOMIC_ACQUIRE))
+            break;
+        uint64_t val;
+        if (read(session->dec_fd, &val, sizeof(val)) < 0 && errno != EINTR) {
+            fprintf(stderr, "decoder eventfd read error (%d) for %s\n", errno, session->src);
+            break;
+        }
+    }
+    cache_flush();
+    return NULL;
+}
+
+// Release the devices whose download is fully decoded
+static void session_downloads_done(amsession_t * session) {
+    uint64_t val;
+    if (read(session->done_fd, &val, sizeof(val)) != sizeof(val))
+        return;
+    int i;
+    for (i = 0; i < session->active_count; ++i) {
+        amdev_t * dev = session->active[i];
+        if (dev->state != STATE_DOWNLOAD || __atomic_load_n(&dev->done_gen, __ATOMIC_ACQUIRE) != dev->dl_gen)
+            continue;
+        dev->state = STATE_COUNT; // Done with command
+        // Back to saving power
+        if (dev->conn_fast && dev->sock >= 0)
+            session_conn_interval(dev, CONN_INTR_SLOW);
+        dev->conn_fast = 0;
+    }
+}
+
+// If an address is one of those loaded in the whitelist
+static int session_wl_listed(amsession_t * session, const bdaddr_t * peer) {
+    bdaddr_t addr;
+    int i;
+    for (i = 0; i < session->wl_added; ++i) {
+        if (str2ba(g_cfg.dst[session->wl_idx[i]], &addr) == 0 && bacmp(&addr, peer) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// A connection is created through the whitelist (or failed to)
+static void session_wl_connected(amsession_t * session, const le_conn_evt_t * evt) {
+    int i;
+    // Links to other devices, or made directly, do not end the whitelist connect
+    if (!session_wl_listed(session, &evt->peer) && !(evt->status && session->wl_cancel))
+        return;
+    session->wl_pending = 0;
+    session->wl_cancel = 0;
+    session->wl_dirty = 1; // Connect to the rest
+    if (evt->status)
+        return; // Cancelled, or did not go through
+    for (i = 0; i < session->active_count; ++i) {
+        amdev_t * dev = session->active[i];
+        bdaddr_t addr;
+        if (!dev->wl_wait || str2ba(g_cfg.dst[dev->dev_idx], &addr) || bacmp(&addr, &evt->peer))
+            continue;
+        // Socket connects over the link just created
+        dev->wl_wait = 0;
+        dev->conn_intr = evt->interval;
+        if (g_opt.verbosity)
+            printf(" (Connected %s through whitelist, interval %.2f ms)\n", g_cfg.dst[dev->dev_idx],
+                    evt->interval * 1.25);
+        timer_set(dev->sched, &dev->timers[TIMER_CONNECT], timer_now_ms() + CONNECT_TIMEOUT_MS);
+        session_connect_direct(session, dev);
+        break;
+    }
+}
+
+// Connection events of the adapter
+static void session_hci_events(amsession_t * session) {
+    le_conn_evt_t evt;
+    int i;
+    while (le_conn_event(session->hci, &evt) == 0) {
+        switch (evt.type) {
+        case LE_EVT_CONNECTED:
+            if (session->wl_pending)
+                session_wl_connected(session, &evt);
+            break;
+        case LE_EVT_CREATE_FAILED:
+            if (session->wl_pending)
+                session_wl_fail(session, "create connection");
+            break;
+        case LE_EVT_WL_SIZE:
+        case LE_EVT_WL_CLEARED:
+        case LE_EVT_WL_ADDED:
+            session_wl_command(session, &evt);
+            break;
+        case LE_EVT_UPDATED:
+            for (i = 0; i < session->active_count; ++i) {
+                amdev_t * dev = session->active[i];
+                if (dev->sock < 0 || dev->conn_handle != evt.handle)
+                    continue;
+                if (evt.status) {
+                    fprintf(stderr, "Connection update of %s failed (0x%02x)\n", g_cfg.dst[dev->dev_idx], evt.status);
+                    break;
+                }
+                dev->conn_intr = evt.interval;
+                printf(" (Connection interval of %s: %.2f ms)\n", g_cfg.dst[dev->dev_idx], evt.interval * 1.25);
+                break;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Open the adapter to create and update the connections of the session
+static void session_hci_init(amsession_t * session) {
+    session->hci = le_conn_open(session->src);
+    if (session->hci >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &session->hci;
+        if (epoll_ctl(session->efd, EPOLL_CTL_ADD, session->hci, &ev) == 0) {
+            if (g_opt.whitelist) {
+                session->wl_idx = calloc(g_opt.max_links, sizeof(int));
+                if (session->wl_idx == NULL) {
+                    fprintf(stderr, "Not enough memory for the whitelist of %s, connecting directly\n", session->src);
+                    session->wl_failed = 1;
+                }
+            }
+            return;
+        }
+        close(session->hci);
+        session->hci = -1;
+    }
+    int err = errno;
+    if (g_opt.whitelist)
+        fprintf(stderr, "Cannot manage connections on %s (%d), connecting directly\n", session->src, err);
+    if (g_opt.fast)
+        fprintf(stderr, "Cannot update connections on %s (%d), asking the devices instead\n", session->src, err);
+}
+
+// Disconnect and release an active device of the session
+static void session_close_device(amsession_t * session, int i) {
+    amdev_t * dev = session->active[i];
+    int j;
+    for (j = 0; j < TIMER_COUNT; ++j)
+        timer_cancel(dev->sched, &dev->timers[j]);
+
+    if (dev->failed)
+        session->failed_count++;
+    else
+        session->done_count++;
+    session_reply(dev, dev->failed ? "failed" : "closed");
+
+    // Reset CPU if need to exit in the middle of firmware update
+    if (dev->state == STATE_FWSTATUS_WAIT && dev->sock >= 0)
+        exec_reset(dev, AMIIGO_CMD_RESET_CPU);
+
+    // Close the socket
+    if (dev->sock >= 0)
+        gap_shutdown(dev->sock);
+    dev->sock = -1;
+    dev->tx_wait = 0;
+    if (dev->wl_wait) {
+        dev->wl_wait = 0;
+        session->wl_dirty = 1;
+    }
+
+    if (dev->trans_spills || g_opt.verbosity)
+        printf(" (ATT requests %s: %u allocated beyond the pool of %d)\n", g_cfg.dst[dev->dev_idx],
+                dev->trans_spills, TRANS_POOL_SIZE);
+    trans_free(dev);
+
+    pthread_mutex_lock(&session->dec_lock);
+    // Keep the active devices packed
+    session->active[i] = session->active[--session->active_count];
+    // Decode thread decodes what is left, closes the log and releases the device
+    dev->dec_next = NULL;
+    *session->dec_closing_tail = dev;
+    session->dec_closing_tail = &dev->dec_next;
+    pthread_mutex_unlock(&session->dec_lock);
+    session_wake_decoder(session);
+}
+
+// Act upon a device deadline
+static void session_timer(amsession_t * session, amtimer_t * timer, uint64_t now) {
+    amdev_t * dev = timer->ctx;
+    switch (timer->id) {
+    case TIMER_CONNECT:
+        device_lost(dev, "connection time out");
+        break;
+    case TIMER_RECONNECT:
+        session_connect_device(session, dev);
+        break;
+    case TIMER_KEEPALIVE:
+        timer_set(dev->sched, timer, now + KEEPALIVE_MS);
+        // No need to keep-alive during firmware update
+        if (dev->state == STATE_FWSTATUS_WAIT)
+            break;
+        if (g_opt.verbosity)
+            printf(" (Keep alive %s)\n", g_cfg.dst[dev->dev_idx]);
+        // Read the status to keep conection alive
+        if (exec_status(dev, process_status))
+            device_lost(dev, "keep alive");
+        break;
+    case TIMER_DOWNLOAD:
+        // If still downloading (non-live)
+        if (dev->state != STATE_DOWNLOAD)
+            break;
+        // Packets are not timed here, see if one came in since the timer was set
+        if (now < dev->download_time + DOWNLOAD_TIMEOUT_MS) {
+            timer_set(dev->sched, timer, dev->download_time + DOWNLOAD_TIMEOUT_MS);
+            break;
+        }
+        // Decode thread is still behind, give it time
+        if (ring_count(&dev->ring)) {
+            timer_set(dev->sched, timer, now + DOWNLOAD_TIMEOUT_MS);
+            break;
+        }
+        // Download timeout reached
+        printf(" (Timeout %s)\n", g_cfg.dst[dev->dev_idx]);
+        device_lost(dev, "download time out");
+        break;
+    case TIMER_FWPOLL:
+        if (fwupdate_poll(dev))
+            device_failed(dev, "firmware update");
+        break;
+    case TIMER_TRANS:
+        if (trans_timeout(dev))
+            device_lost(dev, "request time out");
+        break;
+    default:
+        break;
+    }
+}
+
+// Process one PDU that is not a notification
+// Outputs:
+//   returns the reason if the device is lost, NULL otherwise
+static const char * session_process(amdev_t * dev, uint8_t * buf, int len) {
+    // Process incoming data
+    int ret = process_data(dev, buf, len);
+    if (ret) {
+        fprintf(stderr, "main process_data() error %d in %s\n", ret, g_cfg.dst[dev->dev_idx]);
+        return "process";
+    }
+    // Discovery changed the handle cache, have the decode thread write it
+    if (cache_dirty())
+        session_wake_decoder(dev->session);
+
+    // If all devices have their status read, execute the requested command
+    if (dev->status.battery_level > 0 && dev->state != STATE_COUNT && !dev->started) {
+        if (dev->cmd_done) {
+            // Reconnected after the command finished, wait for the next request
+            dev->started = 1;
+            dev->state = STATE_IDLE;
+            return NULL;
+        }
+        // Now that we have status (e.g. number of logs) of all devices
+        //  Start execution of the requested command
+        ret = exec_command(dev);
+        if (ret) {
+            fprintf(stderr, "exec_command() error %d in %s\n", ret, g_cfg.dst[dev->dev_idx]);
+            return "command";
+        }
+    }
+    return NULL;
+}
+
+// Handle a single received PDU
+//  notifications go to the decode thread, the rest is processed here
+// Outputs:
+//   pushed - set if a notification is queued for the decode thread
+//   returns the reason if the device is lost, NULL otherwise
+static const char * session_pdu(amdev_t * dev, uint8_t * buf, int len, int * pushed) {
+    if (buf[0] != ATT_OP_HANDLE_NOTIFY)
+        return session_process(dev, buf, len);
+    if (ring_push(&dev->ring, buf, len) == 0)
+        *pushed = 1;
+    else if (dev->ring.overflows == 1)
+        fprintf(stderr, "Decode ring full in %s, dropping notifications\n", g_cfg.dst[dev->dev_idx]);
+    return NULL;
+}
+
+// Drain all the PDUs queued on a device socket
+static void session_receive(amdev_t * dev, uint64_t now) {
+    const char * szLost = NULL;
+    int i, n, pushed = 0;
+    do {
+        n = gap_recv_batch(dev->sock, &dev->rx_buf[0][0], RX_PDU_MAX, dev->rx_len, RX_BATCH);
+        if (n < 0) {
+            szLost = "receive";
+            break;
+        }
+        if (n == 0)
+            break;
+
+        // Last time apacket came
+        dev->download_time = now;
+
+        for (i = 0; i < n && szLost == NULL && dev->state != STATE_COUNT; ++i)
+            szLost = session_pdu(dev, dev->rx_buf[i], dev->rx_len[i], &pushed);
+        // A full batch means more may be queued
+    } while (n == RX_BATCH && szLost == NULL && dev->state != STATE_COUNT);
+
+    if (pushed)
+        session_wake_decoder(dev->session);
+    if (szLost != NULL)
+        device_lost(dev, szLost);
+}
+
+// Start the multishot receive of a connected device (io_uring backend)
+static int session_recv_start(amsession_t * session, amdev_t * dev) {
+    // Readiness comes through the ring from now on
+    if (epoll_ctl(session->efd, EPOLL_CTL_DEL, dev->sock, NULL) < 0)
+        return -1;
+    // Tag the receive so completions of an earlier link are not mistaken for this one
+    if (++session->rx_tag == 0)
+        session->rx_tag = 1;
+    dev->rx_tag = session->rx_tag;
+    return uring_recv(&session->rx_ring, dev->sock, RX_USER_DATA(dev));
+}
+
+// Wait for the socket of a connected device to take more writes
+//  the firmware update stream continues once it is writable
+int session_wait_writable(amdev_t * dev) {
+    amsession_t * session = dev->session;
+    if (dev->tx_wait)
+        return 0;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = dev;
+    if (session->uring) {
+        // Receives go through the ring, the socket is only watched while waiting
+        ev.events = EPOLLOUT;
+        if (epoll_ctl(session->efd, EPOLL_CTL_ADD, dev->sock, &ev) < 0)
+            return -1;
+    } else {
+        ev.events = EPOLLIN | EPOLLOUT;
+        if (epoll_ctl(session->efd, EPOLL_CTL_MOD, dev->sock, &ev) < 0)
+            return -1;
+    }
+    dev->tx_wait = 1;
+    return 0;
+}
+
+// Socket of a device that is waiting to write is writable again
+static void session_writable(amsession_t * session, amdev_t * dev) {
+    int ret;
+    dev->tx_wait = 0;
+    if (session->uring) {
+        ret = epoll_ctl(session->efd, EPOLL_CTL_DEL, dev->sock, NULL);
+    } else {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = dev;
+        ret = epoll_ctl(session->efd, EPOLL_CTL_MOD, dev->sock, &ev);
+    }
+    if (ret < 0) {
+        device_failed(dev, "epoll");
+        return;
+    }
+    if (fwupdate_send(dev))
+        device_failed(dev, "firmware update");
+}
+
+// Handle all the completed receives of the session (io_uring backend)
+static void session_uring_receive(amsession_t * session, uint64_t now) {
+    amuring_t * ring = &session->rx_ring;
+    struct io_uring_cqe * cqe;
+    int pushed = 0;
+    while ((cqe = uring_cqe(ring)) != NULL) {
+        const char * szLost = NULL;
+        amdev_t * dev = NULL;
+        if (cqe->user_data != 0) {
+            dev = session_find_device(session, (int)(uint32_t)cqe->user_data);
+            if (dev != NULL && RX_USER_DATA(dev) != cqe->user_data)
+                dev = NULL; // Completion of a link that is already gone
+        }
+        if (dev != NULL) {
+            uint8_t * buf = uring_buf(ring, cqe);
+            if (cqe->res > 0 && buf != NULL) {
+                // Last time apacket came
+                dev->download_time = now;
+                if (dev->state != STATE_COUNT)
+                    szLost = session_pdu(dev, buf, cqe->res, &pushed);
+            } else if (cqe->res != -ENOBUFS) {
+                szLost = cqe->res == 0 ? "disconnected" : "receive";
+            }
+            // Receive stops if we ran out of buffers, start it again
+            if (szLost == NULL && dev->rx_tag && !(cqe->flags & IORING_CQE_F_MORE)) {
+                if (uring_recv(ring, dev->sock, RX_USER_DATA(dev)))
+                    szLost = "receive";
+            }
+        }
+        uring_buf_return(ring, cqe);
+        uring_cqe_seen(ring);
+        if (szLost != NULL)
+            device_lost(dev, szLost);
+    }
+    if (pushed)
+        session_wake_decoder(session);
+}
+
+// Take the queued control requests
+static amreq_t * session_take_requests(amsession_t * session) {
+    pthread_mutex_lock(&session->req_lock);
+    amreq_t * reqs = session->reqs;
+    session->reqs = NULL;
+    session->reqs_tail = &session->reqs;
+    pthread_mutex_unlock(&session->req_lock);
+    return reqs;
+}
+
+// Drop the requests that did not make it to a device
+static void session_drop_requests(amsession_t * session) {
+    amreq_t * req = session_take_requests(session);
+    while (req != NULL) {
+        amreq_t * next = req->next;
+        session_reply_error(req->fd, req->dev_idx, "ended");
+        free(req);
+        req = next;
+    }
+}
+
+// Close the idle device unused for the longest time, so its link can be used by another device
+static void session_release_idle(amsession_t * session) {
+    int i, oldest = -1;
+    for (i = 0; i < session->active_count; ++i) {
+        amdev_t * dev = session->active[i];
+        if (dev->state != STATE_IDLE)
+            continue;
+        if (oldest < 0 || dev->idle_time < session->active[oldest]->idle_time)
+            oldest = i;
+    }
+    if (oldest < 0)
+        return; // All links are busy
+    if (g_opt.verbosity)
+        printf(" (Releasing idle %s)\n", g_cfg.dst[session->active[oldest]->dev_idx]);
+    session_close_device(session, oldest);
+}
+
+// Start the queued control requests on their devices
+static int session_requests(amsession_t * session) {
+    uint64_t val;
+    if (read(session->req_fd, &val, sizeof(val)) != sizeof(val))
+        return 0;
+    amreq_t * req = session_take_requests(session);
+    while (req != NULL) {
+        amreq_t * next = req->next;
+        amdev_t * dev = session_find_device(session, req->dev_idx);
+        if (dev == NULL) {
+            if (session->active_count >= g_opt.max_links)
+                session_release_idle(session);
+            if (session->active_count < g_opt.max_links) {
+                // Connect first, the command runs once status is read
+                if (session_open_device(session, req->dev_idx, req->cmd, req->fd)) {
+                    free(req);
+                    return -1;
+                }
+            } else {
+                session_reply_error(req->fd, req->dev_idx, "no free link");
+            }
+        } else if (dev->state != STATE_IDLE) {
+            session_reply_error(req->fd, req->dev_idx, dev->state == STATE_RECONNECT ? "reconnecting" : "busy");
+        } else {
+            // Connection is warm, refresh the status then execute the command
+            dev->cmd = req->cmd;
+            dev->cmd_done = 0;
+            dev->req_fd = req->fd;
+            dev->started = 0;
+            dev->state = STATE_STATUS;
+            if (exec_status(dev, process_status))
+                device_lost(dev, "status");
+        }
+        free(req);
+        req = next;
+    }
+    return 0;
+}
+
+// Set up the io_uring backend of the session
+static int session_uring_init(amsession_t * session) {
+    if (uring_init(&session->rx_ring, URING_ENTRIES, URING_RX_BUFS, RX_PDU_MAX))
+        return -1;
+    if (uring_init(&session->log_ring, URING_ENTRIES, 0, 0))
+        return -1;
+    // Completed receives wake up the session
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &session->rx_ring;
+    if (epoll_ctl(session->efd, EPOLL_CTL_ADD, session->rx_ring.fd, &ev) < 0)
+        return -1;
+    session->uring = 1;
+    return 0;
+}
+
+// Tear down the io_uring backend of the session, after all devices are closed
+static void session_uring_close(amsession_t * session) {
+    session->uring = 0;
+    uring_close(&session->rx_ring);
+    uring_close(&session->log_ring);
+}
+
+// Run all the devices of one adapter session
+static int session_run(amsession_t * session) {
+    int i;
+
+    session->active = calloc(g_opt.max_links, sizeof(amdev_t *));
+    session->dec_active = calloc(g_opt.max_links, sizeof(amdev_t *));
+    if (session->active == NULL || session->dec_active == NULL) {
+        fprintf(stderr, "Not enough memory for session %s\n", session->src);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+
+    // Wait on all device sockets at once
+    int efd = epoll_create1(0);
+    session->efd = efd;
+    if (efd < 0) {
+        fprintf(stderr, "epoll_create1() error (%d)\n", errno);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+
+    // Device deadlines fire through a single timerfd
+    if (timers_init(&session->timers)) {
+        close(efd);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+    struct epoll_event tev;
+    memset(&tev, 0, sizeof(tev));
+    tev.events = EPOLLIN;
+    tev.data.ptr = &session->timers;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, session->timers.fd, &tev) < 0) {
+        fprintf(stderr, "epoll_ctl() error (%d) for timers\n", errno);
+        timers_close(&session->timers);
+        close(efd);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+    // Control requests for the devices of this session
+    struct epoll_event rev;
+    memset(&rev, 0, sizeof(rev));
+    rev.events = EPOLLIN;
+    rev.data.ptr = &session->reqs;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, session->req_fd, &rev) < 0) {
+        fprintf(stderr, "epoll_ctl() error (%d) for requests\n", errno);
+        timers_close(&session->timers);
+        close(efd);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+    // User ending the run wakes up all the sessions
+    struct epoll_event cev;
+    memset(&cev, 0, sizeof(cev));
+    cev.events = EPOLLIN;
+    cev.data.ptr = &g_ctl;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, g_ctl.stop_fd, &cev) < 0) {
+        fprintf(stderr, "epoll_ctl() error (%d) for control\n", errno);
+        timers_close(&session->timers);
+        close(efd);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+    // Downloads fully decoded by the decode thread
+    struct epoll_event oev;
+    memset(&oev, 0, sizeof(oev));
+    oev.events = EPOLLIN;
+    oev.data.ptr = &session->done_fd;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, session->done_fd, &oev) < 0) {
+        fprintf(stderr, "epoll_ctl() error (%d) for decoder\n", errno);
+        timers_close(&session->timers);
+        close(efd);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+    // Receives and log writes may go through io_uring instead
+    if (g_opt.uring && session_uring_init(session)) {
+        fprintf(stderr, "io_uring not available for %s, using epoll\n", session->src);
+        session_uring_close(session);
+    }
+    // Connections and their interval switches go through the adapter, if allowed
+    if (g_opt.fast || g_opt.whitelist)
+        session_hci_init(session);
+    // Decoding and output happen on their own thread
+    if (pthread_create(&session->decoder, NULL, decode_thread, session)) {
+        fprintf(stderr, "Cannot start decoder for %s\n", session->src);
+        if (session->hci >= 0)
+            close(session->hci);
+        free(session->wl_idx);
+        session->wl_idx = NULL;
+        session_uring_close(session);
+        timers_close(&session->timers);
+        close(efd);
+        free(session->active);
+        free(session->dec_active);
+        return -1;
+    }
+
+    int bQuit = 0;
+    while (!bQuit) {
+        // Release devices that are done, or failed
+        for (i = session->active_count - 1; i >= 0; --i) {
+            amdev_t * dev = session->active[i];
+            if (dev->state != STATE_COUNT)
+                continue;
+            if (g_opt.ctl_path != NULL && !dev->failed) {
+                session_command_done(dev);
+                continue;
+            }
+            session_close_device(session, i);
+        }
+        // Start connecting to pending devices together, as links become available
+        while (session->next < session->count && session->active_count < g_opt.max_links) {
+            int dev_idx = session->dst_idx[session->next++];
+            if (session_find_device(session, dev_idx) != NULL)
+                continue; // Already connected upon request
+            if (session_open_device(session, dev_idx, g_cmd, -1)) {
+                bQuit = 1;
+                break;
+            }
+        }
+        // Done the the command on all devices (daemon waits for requests)
+        if (session->active_count == 0 && g_opt.ctl_path == NULL)
+            break;
+
+        // Do not wait if a device failed already and its link can be reused
+        int timeout = -1;
+        for (i = 0; i < session->active_count; ++i) {
+            if (session->active[i]->state == STATE_COUNT)
+                timeout = 0;
+        }
+
+        // Adapter connects to the devices waiting for it
+        session_wl_sync(session);
+
+        // Wake up for the earliest device deadline
+        if (timers_arm(&session->timers))
+            break;
+        // Hand the queued receives and cancellations to the kernel
+        if (session->uring && uring_submit(&session->rx_ring, 0))
+            break;
+
+        struct epoll_event events[SESSION_MAX_EVENTS];
+        int nfds = epoll_wait(efd, events, SESSION_MAX_EVENTS, timeout);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "main epoll_wait() error (%d)\n", errno);
+            break;
+        }
+
+        uint64_t now = timer_now_ms();
+
+        int k;
+        for (k = 0; k < nfds && !bQuit; ++k) {
+            if (events[k].data.ptr == &g_ctl) {
+                // User ended the run
+                bQuit = 1;
+                break;
+            }
+            if (events[k].data.ptr == &session->rx_ring) {
+                session_uring_receive(session, now);
+                continue;
+            }
+            if (events[k].data.ptr == &session->done_fd) {
+                session_downloads_done(session);
+                continue;
+            }
+            if (events[k].data.ptr == &session->hci) {
+                session_hci_events(session);
+                continue;
+            }
+            if (events[k].data.ptr == &session->reqs) {
+                if (session_requests(session))
+                    bQuit = 1;
+                continue;
+            }
+            if (events[k].data.ptr == &session->timers) {
+                // Act upon all the deadlines that are due
+                timers_fired(&session->timers);
+                amtimer_t * timer;
+                while ((timer = timers_expired(&session->timers, now)) != NULL)
+                    session_timer(session, timer, now);
+                continue;
+            }
+
+            amdev_t * dev = events[k].data.ptr;
+            int dev_idx = dev->dev_idx;
+
+            if (dev->sock < 0)
+                continue; // Socket is already closed
+
+            if (dev->state == STATE_CONNECTING) {
+                timer_cancel(dev->sched, &dev->timers[TIMER_CONNECT]);
+                if (gap_connect_finish(dev->sock, session->src, g_cfg.dst[dev_idx], &dev->mtu)) {
+                    device_lost(dev, "connect");
+                    continue;
+                }
+                // Connection interval is known once updated
+                dev->conn_intr = 0;
+                dev->conn_fast = 0;
+                if (session->hci >= 0)
+                    gap_conn_handle(dev->sock, &dev->conn_handle);
+                // Connected, now wait for incoming data
+                if (session->uring) {
+                    if (session_recv_start(session, dev)) {
+                        device_failed(dev, "io_uring");
+                        continue;
+                    }
+                } else {
+                    struct epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = dev;
+                    if (epoll_ctl(efd, EPOLL_CTL_MOD, dev->sock, &ev) < 0) {
+                        device_failed(dev, "epoll");
+                        continue;
+                    }
+                }
+                dev->state = STATE_NONE;
+                // Larger notifications if the device can take them, discovery queues behind
+                if (trans_exchange_mtu(dev, ATT_MTU_MAX, process_mtu)) {
+                    device_lost(dev, "mtu");
+                    continue;
+                }
+                if (start_discovery(dev)) {
+                    device_lost(dev, "discovery");
+                    continue;
+                }
+                // Keep the connection alive
+                timer_set(dev->sched, &dev->timers[TIMER_KEEPALIVE], now + KEEPALIVE_MS);
+                continue;
+            }
+
+            // Take what is already received before handling the disconnect
+            if ((events[k].events & (EPOLLERR | EPOLLHUP)) && !(events[k].events & EPOLLIN)) {
+                device_lost(dev, "disconnected");
+                continue;
+            }
+
+            if ((events[k].events & EPOLLOUT) && dev->tx_wait) {
+                session_writable(session, dev);
+                if (dev->sock < 0)
+                    continue;
+            }
+            // Receives of the io_uring backend complete through the ring
+            if (!session->uring)
+                session_receive(dev, now);
+        } // end for(k
+
+    } //end while(!bQuit
+
+    close(efd);
+
+    for (i = session->active_count - 1; i >= 0; --i)
+        session_close_device(session, i);
+
+    // Decode thread ends once nothing is left to decode
+    __atomic_store_n(&session->dec_quit, 1, __ATOMIC_RELEASE);
+    uint64_t val = 1;
+    if (write(session->dec_fd, &val, sizeof(val)) != sizeof(val))
+        fprintf(stderr, "eventfd write error (%d) for %s\n", errno, session->src);
+    pthread_join(session->decoder, NULL);
+
+    session_drop_requests(session);
+    session_uring_close(session);
+    if (session->hci >= 0) {
+        close(session->hci);
+        session->hci = -1;
+    }
+    free(session->wl_idx);
+    session->wl_idx = NULL;
+    timers_close(&session->timers);
+    free(session->active);
+    session->active = NULL;
+    free(session->dec_active);
+    session->dec_active = NULL;
+
+    return 0;
+}
+
+// Initialize an adapter session, before its thread starts
+int session_init(amsession_t * session, int idx, const char * src) {
+    memset(session, 0, sizeof(*session));
+    session->idx = idx;
+    session->src = src;
+    session->reqs = NULL;
+    session->reqs_tail = &session->reqs;
+    pthread_mutex_init(&session->req_lock, NULL);
+    pthread_mutex_init(&session->dec_lock, NULL);
+    session->dec_closing_tail = &session->dec_closing;
+    session->rx_ring.fd = -1;
+    session->hci = -1;
+    session->log_ring.fd = -1;
+    session->dec_fd = -1;
+    session->done_fd = -1;
+    session->req_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (session->req_fd < 0) {
+        fprintf(stderr, "eventfd() error (%d) for %s\n", errno, src);
+        return -1;
+    }
+    // Decode thread blocks on this one while there is nothing to decode
+    session->dec_fd = eventfd(0, EFD_CLOEXEC);
+    if (session->dec_fd < 0) {
+        fprintf(stderr, "eventfd() error (%d) for %s\n", errno, src);
+        return -1;
+    }
+    session->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (session->done_fd < 0) {
+        fprintf(stderr, "eventfd() error (%d) for %s\n", errno, src);
+        return -1;
+    }
+    return 0;
+}
+
+// Release an adapter session, after its thread ended
+void session_release(amsession_t * session) {
+    session_drop_requests(session);
+    if (session->req_fd >= 0)
+        close(session->req_fd);
+    session->req_fd = -1;
+    if (session->dec_fd >= 0)
+        close(session->dec_fd);
+    session->dec_fd = -1;
+    if (session->done_fd >= 0)
+        close(session->done_fd);
+    session->done_fd = -1;
+    pthread_mutex_destroy(&session->req_lock);
+    pthread_mutex_destroy(&session->dec_lock);
+    free(session->dst_idx);
+    session->dst_idx = NULL;
+}
+
+// Queue a control request for a device of the session
+//  the session owns (and eventually replies to and closes) the client fd
+int session_submit(amsession_t * session, int dev_idx, AMIIGO_CMD cmd, int fd) {
+    amreq_t * req = calloc(1, sizeof(amreq_t));
+    if (req == NULL)
+        return -1;
+    req->dev_idx = dev_idx;
+    req->cmd = cmd;
+    req->fd = fd;
+    pthread_mutex_lock(&session->req_lock);
+    *session->reqs_tail = req;
+    session->reqs_tail = &req->next;
+    pthread_mutex_unlock(&session->req_lock);
+
+    uint64_t val = 1;
+    if (write(session->req_fd, &val, sizeof(val)) != sizeof(val))
+        fprintf(stderr, "eventfd write error (%d) for %s\n", errno, session->src);
+    return 0;
+}
+
+// I/O thread of an adapter session
+void * session_thread(void * arg) {
+    amsession_t * session = arg;
+
+    session_run(session);
+
+    if (__sync_sub_and_fetch(&g_running_sessions, 1) == 0)
+        ctl_sessions_done();
+    return NULL;
+}
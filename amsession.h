@@ -0,0 +1,91 @@
+/*
+ * Amiigo Link device session (one I/O thread per adapter)
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMSESSION_H
+#define AMSESSION_H
+
+#include <pthread.h>
+
+#include "amdev.h"
+#include "amcmd.h"
+#include "amtimer.h"
+#include "amuring.h"
+
+// A control request waiting for its session
+typedef struct _amreq {
+    int dev_idx;                      // Device index in g_cfg.dst
+    AMIIGO_CMD cmd;                   // Command to execute
+    int fd;                           // Control client to reply to
+    struct _amreq * next;
+} amreq_t;
+
+// Whitelist command waiting for its completion
+typedef enum _WL_STEP {
+    WL_STEP_NONE = 0,
+    WL_STEP_SIZE,       // Reading the whitelist size
+    WL_STEP_CLEAR,      // Emptying the whitelist
+    WL_STEP_ADD,        // Adding the next device
+} WL_STEP;
+
+// Keep the state of each adapter session here
+typedef struct _amsession {
+    int idx;                          // Session index
+    const char * src;                 // Adapter to connect from
+    int count;                        // Number of devices in this session
+    int * dst_idx;                    // Index of each device of this session in g_cfg.dst
+    int next;                         // Next device of this session to connect to
+    int active_count;                 // Number of devices connecting or connected
+    amdev_t ** active;                // Devices connecting or connected (up to max_links)
+    int done_count;                   // Devices that finished in this session
+    int failed_count;                 // Devices that failed in this session
+    int efd;                          // epoll set of the devices in this session
+    amtimers_t timers;                // Deadlines of the devices in this session
+    int req_fd;                       // eventfd signaled when requests are queued
+    pthread_mutex_t req_lock;         // Protects the request queue
+    amreq_t * reqs;                   // Queued control requests
+    amreq_t ** reqs_tail;             // Where to queue the next request
+    pthread_t thread;                 // I/O thread of this session
+    pthread_t decoder;                // Decode and output thread of this session
+    pthread_mutex_t dec_lock;         // Protects the active devices list and dec_closing
+    amdev_t ** dec_active;            // Active devices being decoded (decode thread)
+    amdev_t * dec_closing;            // Closed devices for the decode thread to finish and release
+    amdev_t ** dec_closing_tail;      // Where to queue the next closed device
+    int dec_fd;                       // eventfd waking up the decode thread
+    int dec_idle;                     // If the decode thread is waiting on dec_fd
+    int dec_quit;                     // If the decode thread must end
+    int done_fd;                      // eventfd signaled when a download is fully decoded
+    int uring;                        // If receives and log writes go through io_uring
+    amuring_t rx_ring;                // Multishot receives of the device sockets (I/O thread)
+    amuring_t log_ring;               // Log file writes (decode thread)
+    uint32_t rx_tag;                  // Tag of the last receive started
+    int hci;                          // Adapter managing the connections (-1 if not available)
+    int wl_pending;                   // If connecting through the whitelist
+    int wl_cancel;                    // If connecting through the whitelist is being cancelled
+    int wl_dirty;                     // If devices waiting for the whitelist have changed
+    int wl_failed;                    // If the whitelist cannot be used, devices connect directly
+    WL_STEP wl_step;                  // Whitelist command waiting for its completion
+    int wl_size;                      // Devices the adapter whitelist can take (0 if not read yet)
+    int * wl_idx;                     // Devices being put in the whitelist, index in g_cfg.dst (up to max_links)
+    int wl_count;                     // Number of devices being put in the whitelist
+    int wl_added;                     // Devices put in the whitelist so far
+} amsession_t;
+
+extern volatile int g_running_sessions;
+
+// Devices are spread across the adapters round-robin
+static inline int session_of_device(int dev_idx) {
+    return dev_idx % g_cfg.count_src;
+}
+
+int session_init(amsession_t * session, int idx, const char * src);
+void session_release(amsession_t * session);
+int session_submit(amsession_t * session, int dev_idx, AMIIGO_CMD cmd, int fd);
+int session_wait_writable(amdev_t * dev);
+void * session_thread(void * arg);
+
+#endif // include guard
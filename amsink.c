@@ -0,0 +1,264 @@
+/*
+ * Amiigo Link decoded log records and their output
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  the decoder hands typed records to a sink, only the sink knows the output format
+ *  the JSON lines sink writes one log file per device (opened upon the first record),
+ *  lines are formatted without printf into a buffer per device,
+ *  written out each time the decoder has drained what the device received
+ *  stdout is unbuffered, so accel lines echoed to console are buffered the same way
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "amdev.h"
+#include "amsession.h"
+#include "amsink.h"
+
+#define JSON_BUF_SIZE (64 * 1024) // Lines of a device buffered before written to its file
+#define JSON_LINE_MAX 256         // Longest line (compressed accel with 18 bytes of data)
+#define JSON_CON_SIZE (8 * 1024)  // Accel lines of a device buffered before echoed to console
+
+extern char g_szBaseName[256];
+
+// Lines formatted and not yet written
+typedef struct _json_out {
+    size_t len;
+    size_t con_len;
+    char buf[JSON_BUF_SIZE];
+    char con[JSON_CON_SIZE];  // Lines to echo to console
+} json_out_t;
+
+// Open file for logging
+// Inputs:
+//   szBase - the base name of the log
+static FILE * log_file_open(amdev_t * dev) {
+    // Downloaded file
+    char szFullName[1024] = { 0 };
+
+    // Use other metadata to distinguish each log
+    if (dev->dev_idx == 0) {
+        if (strchr(g_szBaseName, '.'))
+            sprintf(szFullName, "%s", g_szBaseName);
+        else
+            sprintf(szFullName, "%s.log", g_szBaseName);
+    } else {
+        if (strchr(g_szBaseName, '.'))
+            sprintf(szFullName, "d%d_%s", dev->dev_idx, g_szBaseName);
+        else
+            sprintf(szFullName, "d%d_%s.log", dev->dev_idx, g_szBaseName);
+    }
+    printf("\ndownloading %s ...\n", szFullName);
+
+    FILE * fp;
+    if (dev->session != NULL && dev->session->uring)
+        fp = uring_fopen(&dev->session->log_ring, szFullName, g_opt.append);
+    else
+        fp = fopen(szFullName, g_opt.append ? "a" : "w");
+    return fp;
+}
+
+// Two digits of each number below 100
+static const char g_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Append an unsigned number as text
+static inline char * put_u32(char * p, uint32_t v) {
+    char tmp[10];
+    char * t = tmp + sizeof(tmp);
+    while (v >= 100) {
+        uint32_t r = (v % 100) * 2;
+        v /= 100;
+        *--t = g_digits[r + 1];
+        *--t = g_digits[r];
+    }
+    if (v >= 10) {
+        *--t = g_digits[v * 2 + 1];
+        *--t = g_digits[v * 2];
+    } else {
+        *--t = '0' + v;
+    }
+    memcpy(p, t, tmp + sizeof(tmp) - t);
+    return p + (tmp + sizeof(tmp) - t);
+}
+
+// Append a signed number as text
+static inline char * put_i32(char * p, int32_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return put_u32(p, -(uint32_t)v);
+    }
+    return put_u32(p, v);
+}
+
+// Append a string literal
+#define PUT_STR(p, s) (memcpy(p, s, sizeof(s) - 1), (p) + sizeof(s) - 1)
+
+// Write the buffered lines of a device to its log file
+static void json_flush(amdev_t * dev) {
+    json_out_t * out = dev->sink_ctx;
+    if (out == NULL || out->len == 0)
+        return;
+    fwrite(out->buf, 1, out->len, dev->logFile);
+    out->len = 0;
+    if (out->con_len) {
+        fwrite(out->con, 1, out->con_len, stdout);
+        out->con_len = 0;
+    }
+}
+
+// Write a record as a JSON line
+//  lines are formatted by hand into the device buffer, byte-identical to their printf forms
+static void json_record(amdev_t * dev, const amrecord_t * rec) {
+    int i;
+    if (dev->logFile == NULL) {
+        dev->logFile = log_file_open(dev);
+        if (dev->logFile == NULL)
+            return;
+    }
+    json_out_t * out = dev->sink_ctx;
+    if (out == NULL) {
+        out = malloc(sizeof(json_out_t));
+        if (out == NULL)
+            return;
+        out->len = 0;
+        out->con_len = 0;
+        dev->sink_ctx = out;
+    }
+    if (out->len > sizeof(out->buf) - JSON_LINE_MAX || out->con_len > sizeof(out->con) - JSON_LINE_MAX)
+        json_flush(dev);
+    char * line = &out->buf[out->len];
+    char * p = line;
+
+    switch (rec->type) {
+    case RECORD_TIMESTAMP:
+        p = PUT_STR(p, "[\"timestamp\",[");
+        p = put_u32(p, rec->time.timestamp);
+        *p++ = ',';
+        p = put_u32(p, rec->time.flags);
+        p = PUT_STR(p, "]]\n");
+        break;
+    case RECORD_EVENT:
+        p = PUT_STR(p, "[\"event\",[\"flags\",");
+        p = put_u32(p, rec->event.flags);
+        p = PUT_STR(p, "]]\n");
+        break;
+    case RECORD_COUNT:
+        p = PUT_STR(p, "[\"log_count\",[\"log_timestamp\",");
+        p = put_u32(p, rec->count.log_timestamp);
+        p = PUT_STR(p, "],[\"log_accel_count\",");
+        p = put_u32(p, rec->count.log_accel_count);
+        p = PUT_STR(p, "],[\"old_timestamp\",");
+        p = put_u32(p, rec->count.old_timestamp);
+        p = PUT_STR(p, "],[\"timestamp\",");
+        p = put_u32(p, rec->count.timestamp);
+        p = PUT_STR(p, "]]\n");
+        break;
+    case RECORD_ACCEL:
+        p = PUT_STR(p, "[\"accelerometer\",[");
+        p = put_i32(p, rec->accel.accel[0]);
+        *p++ = ',';
+        p = put_i32(p, rec->accel.accel[1]);
+        *p++ = ',';
+        p = put_i32(p, rec->accel.accel[2]);
+        p = PUT_STR(p, "]]\n");
+        if (g_opt.console) {
+            memcpy(&out->con[out->con_len], line, p - line);
+            out->con_len += p - line;
+        }
+        break;
+    case RECORD_ACCEL_CMP:
+        p = PUT_STR(p, "[\"accelerometer_compressed\",[\"count_bits\",");
+        p = put_u32(p, rec->accel_cmp.count_bits);
+        p = PUT_STR(p, "],[\"data\",[");
+        for (i = 0; i < rec->accel_cmp.len; ++i) {
+            if (i)
+                *p++ = ',';
+            p = put_u32(p, rec->accel_cmp.data[i]);
+        }
+        p = PUT_STR(p, "]]]\n");
+        break;
+    case RECORD_LS_CONFIG:
+        p = PUT_STR(p, "[\"lightsensor_config\",[\"dac_on\",");
+        p = put_u32(p, rec->ls_config.dac_on);
+        p = PUT_STR(p, "],[\"flags\",");
+        p = put_u32(p, rec->ls_config.flags);
+        p = PUT_STR(p, "],[\"level_led\",");
+        p = put_u32(p, rec->ls_config.level_led);
+        p = PUT_STR(p, "],[\"gain\",");
+        p = put_u32(p, rec->ls_config.gain);
+        p = PUT_STR(p, "],[\"log_size\",");
+        p = put_u32(p, rec->ls_config.log_size);
+        p = PUT_STR(p, "]]\n");
+        break;
+    case RECORD_LS_DATA: {
+        int cnt = 0;
+        if (rec->ls_data.fields == 0)
+            break;
+        p = PUT_STR(p, "[\"lightsensor\"");
+        if (rec->ls_data.fields & RECORD_LS_RED) {
+            p = PUT_STR(p, ",[\"red\",");
+            p = put_u32(p, rec->ls_data.val[cnt++]);
+            *p++ = ']';
+        }
+        if (rec->ls_data.fields & RECORD_LS_IR) {
+            p = PUT_STR(p, ",[\"ir\",");
+            p = put_u32(p, rec->ls_data.val[cnt++]);
+            *p++ = ']';
+        }
+        if (rec->ls_data.fields & RECORD_LS_OFF) {
+            p = PUT_STR(p, ",[\"off\",");
+            p = put_u32(p, rec->ls_data.val[cnt++]);
+            *p++ = ']';
+        }
+        p = PUT_STR(p, "]\n");
+        break;
+    }
+    case RECORD_TEMP:
+        p = PUT_STR(p, "[\"temperature\",");
+        p = put_i32(p, rec->temp.temperature);
+        p = PUT_STR(p, "]\n");
+        break;
+    case RECORD_TAG:
+        p = PUT_STR(p, "[\"tag\",");
+        p = put_u32(p, rec->tag.tag);
+        p = PUT_STR(p, "]\n");
+        break;
+    default:
+        break;
+    }
+    out->len += p - line;
+}
+
+// Close the log file of a device
+static void json_close(amdev_t * dev) {
+    if (dev->logFile != NULL) {
+        json_flush(dev);
+        fclose(dev->logFile);
+        dev->logFile = NULL;
+    }
+    free(dev->sink_ctx);
+    dev->sink_ctx = NULL;
+}
+
+// JSON lines, one file per device
+const amsink_t g_sink_json = {
+    .name = "json",
+    .record = json_record,
+    .flush = json_flush,
+    .close = json_close,
+};
+
+const amsink_t * g_sink = &g_sink_json; // Sink of all the sessions
@@ -0,0 +1,97 @@
+/*
+ * Amiigo Link decoded log records and their output
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMSINK_H
+#define AMSINK_H
+
+#include <stdint.h>
+
+#include "amdev.h"
+
+// Light sensor readings present in a record
+#define RECORD_LS_RED 0x01
+#define RECORD_LS_IR  0x02
+#define RECORD_LS_OFF 0x04
+
+typedef enum _RECORD_TYPE {
+    RECORD_TIMESTAMP = 0,
+    RECORD_EVENT,
+    RECORD_COUNT,
+    RECORD_ACCEL,       // One accel sample (compressed logs are expanded to these)
+    RECORD_ACCEL_CMP,   // Compressed accel left as it is
+    RECORD_LS_CONFIG,
+    RECORD_LS_DATA,
+    RECORD_TEMP,
+    RECORD_TAG,
+} RECORD_TYPE;
+
+// A single decoded log entry
+typedef struct _amrecord {
+    RECORD_TYPE type;
+    union {
+        struct {
+            uint32_t timestamp;
+            uint8_t flags;      // TIMESTAMP_*
+        } time;
+        struct {
+            uint8_t flags;      // EVENT_FLAGS_*
+        } event;
+        struct {
+            uint32_t log_timestamp;
+            uint16_t log_accel_count;
+            uint32_t old_timestamp;
+            uint32_t timestamp;
+        } count;
+        struct {
+            int8_t accel[3];
+        } accel;
+        struct {
+            uint8_t count_bits;
+            int len;            // Size of data in bytes
+            const uint8_t * data; // Packed samples, only valid during the call
+        } accel_cmp;
+        struct {
+            uint8_t dac_on;
+            uint8_t flags;      // LSCONF_FLAGS_*
+            uint8_t level_led;
+            uint8_t gain;
+            uint8_t log_size;
+        } ls_config;
+        struct {
+            uint8_t fields;     // RECORD_LS_* readings present
+            uint16_t val[3];    // Readings present, in red, ir, off order
+        } ls_data;
+        struct {
+            int16_t temperature; // DegC * 10
+        } temp;
+        struct {
+            uint32_t tag;
+        } tag;
+    };
+} amrecord_t;
+
+// Where decoded records go, called from the decode thread of the device session
+typedef struct _amsink {
+    const char * name;
+    // Output a record, records of a device come in log order
+    void (*record)(amdev_t * dev, const amrecord_t * rec);
+    // Records received so far are decoded, output what is buffered
+    void (*flush)(amdev_t * dev);
+    // Device is done, flush and release its output
+    void (*close)(amdev_t * dev);
+} amsink_t;
+
+extern const amsink_t g_sink_json;
+extern const amsink_t * g_sink;
+
+// Hand a decoded record to the sink
+static inline void sink_record(amdev_t * dev, const amrecord_t * rec) {
+    g_sink->record(dev, rec);
+}
+
+#endif // include guard
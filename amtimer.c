@@ -0,0 +1,173 @@
+/*
+ * Amiigo Link timer scheduling
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  deadlines are kept in a min-heap, only the earliest one is armed
+ *  in the timerfd, so idle devices cost no syscalls
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <sys/timerfd.h>
+
+#include "amtimer.h"
+
+// Current monotonic time in ms
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + ts.tv_nsec / 1000000u;
+}
+
+// Initialize a timer that is not scheduled
+void timer_init(amtimer_t * timer, int id, void * ctx) {
+    timer->deadline = 0;
+    timer->heap_idx = -1;
+    timer->id = id;
+    timer->ctx = ctx;
+}
+
+// Initialize the session timers
+int timers_init(amtimers_t * timers) {
+    memset(timers, 0, sizeof(*timers));
+    timers->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timers->fd < 0) {
+        fprintf(stderr, "timerfd_create() error (%d)\n", errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Release the session timers
+void timers_close(amtimers_t * timers) {
+    if (timers->fd >= 0)
+        close(timers->fd);
+    timers->fd = -1;
+    free(timers->heap);
+    timers->heap = NULL;
+    timers->count = 0;
+    timers->alloc = 0;
+}
+
+static void heap_place(amtimers_t * timers, amtimer_t * timer, int idx) {
+    timers->heap[idx] = timer;
+    timer->heap_idx = idx;
+}
+
+static void heap_up(amtimers_t * timers, int idx) {
+    amtimer_t * timer = timers->heap[idx];
+    while (idx > 0) {
+        int parent = (idx - 1) / 2;
+        if (timers->heap[parent]->deadline <= timer->deadline)
+            break;
+        heap_place(timers, timers->heap[parent], idx);
+        idx = parent;
+    }
+    heap_place(timers, timer, idx);
+}
+
+static void heap_down(amtimers_t * timers, int idx) {
+    amtimer_t * timer = timers->heap[idx];
+    for (;;) {
+        int child = 2 * idx + 1;
+        if (child >= timers->count)
+            break;
+        if (child + 1 < timers->count && timers->heap[child + 1]->deadline < timers->heap[child]->deadline)
+            child++;
+        if (timer->deadline <= timers->heap[child]->deadline)
+            break;
+        heap_place(timers, timers->heap[child], idx);
+        idx = child;
+    }
+    heap_place(timers, timer, idx);
+}
+
+// Schedule (or re-schedule) a timer
+// Inputs:
+//   deadline - monotonic time in ms to fire at
+int timer_set(amtimers_t * timers, amtimer_t * timer, uint64_t deadline) {
+    if (timer->heap_idx < 0) {
+        if (timers->count == timers->alloc) {
+            int alloc = timers->alloc ? 2 * timers->alloc : 16;
+            amtimer_t ** heap = realloc(timers->heap, alloc * sizeof(amtimer_t *));
+            if (heap == NULL)
+                return -1;
+            timers->heap = heap;
+            timers->alloc = alloc;
+        }
+        timer->deadline = deadline;
+        heap_place(timers, timer, timers->count++);
+        heap_up(timers, timer->heap_idx);
+        return 0;
+    }
+    uint64_t old_deadline = timer->deadline;
+    timer->deadline = deadline;
+    if (deadline < old_deadline)
+        heap_up(timers, timer->heap_idx);
+    else
+        heap_down(timers, timer->heap_idx);
+    return 0;
+}
+
+// Remove a timer from the schedule
+void timer_cancel(amtimers_t * timers, amtimer_t * timer) {
+    int idx = timer->heap_idx;
+    if (idx < 0)
+        return;
+    timer->heap_idx = -1;
+    timers->count--;
+    if (idx == timers->count)
+        return;
+    amtimer_t * last = timers->heap[timers->count];
+    heap_place(timers, last, idx);
+    if (last->deadline < timer->deadline)
+        heap_up(timers, idx);
+    else
+        heap_down(timers, idx);
+}
+
+// Take the next expired timer off the schedule, or NULL if none is due
+amtimer_t * timers_expired(amtimers_t * timers, uint64_t now) {
+    if (timers->count == 0 || timers->heap[0]->deadline > now)
+        return NULL;
+    amtimer_t * timer = timers->heap[0];
+    timer_cancel(timers, timer);
+    return timer;
+}
+
+// Acknowledge the timerfd when it is readable
+void timers_fired(amtimers_t * timers) {
+    uint64_t expirations;
+    if (read(timers->fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        timers->armed = 0;
+}
+
+// Arm the timerfd at the earliest deadline
+//  only touches the timerfd if the earliest deadline moved before the armed one
+int timers_arm(amtimers_t * timers) {
+    uint64_t deadline = timers->count ? timers->heap[0]->deadline : 0;
+    if (deadline == 0 || (timers->armed != 0 && timers->armed <= deadline))
+        return 0;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000u;
+    its.it_value.tv_nsec = (deadline % 1000u) * 1000000u;
+    if (timerfd_settime(timers->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        fprintf(stderr, "timerfd_settime() error (%d)\n", errno);
+        return -1;
+    }
+    timers->armed = deadline;
+    return 0;
+}
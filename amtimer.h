@@ -0,0 +1,44 @@
+/*
+ * Amiigo Link timer scheduling
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMTIMER_H
+#define AMTIMER_H
+
+#include <stdint.h>
+
+// A single deadline
+typedef struct _amtimer {
+    uint64_t deadline;  // Monotonic time in ms to fire at
+    int heap_idx;       // Position in the scheduler heap (-1 if not scheduled)
+    int id;             // What this timer is for
+    void * ctx;         // Owner of the timer
+} amtimer_t;
+
+// All the deadlines of a session, the earliest one arms the timerfd
+typedef struct _amtimers {
+    int fd;             // timerfd to wait on
+    uint64_t armed;     // Deadline the timerfd is armed at (0 if disarmed)
+    int count;          // Number of scheduled timers
+    int alloc;          // Number of allocated heap entries
+    amtimer_t ** heap;  // Min-heap of scheduled timers
+} amtimers_t;
+
+uint64_t timer_now_ms(void);
+
+void timer_init(amtimer_t * timer, int id, void * ctx);
+int timers_init(amtimers_t * timers);
+void timers_close(amtimers_t * timers);
+
+int timer_set(amtimers_t * timers, amtimer_t * timer, uint64_t deadline);
+void timer_cancel(amtimers_t * timers, amtimer_t * timer);
+
+amtimer_t * timers_expired(amtimers_t * timers, uint64_t now);
+void timers_fired(amtimers_t * timers);
+int timers_arm(amtimers_t * timers);
+
+#endif // include guard
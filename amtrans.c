@@ -0,0 +1,267 @@
+/*
+ * Amiigo Link ATT client transactions
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  ATT allows a single outstanding request per connection
+ *  requests are queued per device and sent one after the other,
+ *  each response is matched to its request and handed to its completion
+ *  commands (write without response) do not take part and are sent directly
+ *  requests come from a preallocated pool per device and are encoded in place,
+ *  so once connected no allocation is made
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "jni/bluetooth.h"
+#include "att.h"
+
+#include "common.h"
+#include "amdev.h"
+#include "amtrans.h"
+
+// Take a request to fill in
+static amtrans_t * trans_get(amdev_t * dev) {
+    amtrans_t * trans = dev->trans_free;
+    if (trans == NULL) {
+        // Pool is exhausted, counted so a pool too small shows up
+        dev->trans_spills++;
+        return malloc(sizeof(amtrans_t));
+    }
+    dev->trans_free = trans->next;
+    return trans;
+}
+
+// Give back a request that is done
+static void trans_put(amdev_t * dev, amtrans_t * trans) {
+    if (trans == NULL)
+        return;
+    if (trans < dev->trans_pool || trans >= dev->trans_pool + TRANS_POOL_SIZE) {
+        free(trans);
+        return;
+    }
+    trans->next = dev->trans_free;
+    dev->trans_free = trans;
+}
+
+// Prepare the request pool and an empty request queue
+int trans_init(amdev_t * dev) {
+    int i;
+    dev->trans_pool = calloc(TRANS_POOL_SIZE, sizeof(amtrans_t));
+    if (dev->trans_pool == NULL)
+        return -1;
+    dev->trans_free = NULL;
+    for (i = 0; i < TRANS_POOL_SIZE; ++i)
+        trans_put(dev, &dev->trans_pool[i]);
+    dev->trans = NULL;
+    dev->trans_queue = NULL;
+    dev->trans_tail = &dev->trans_queue;
+    return 0;
+}
+
+// Drop the outstanding and queued requests without completing them
+//  the connection is gone, so is the need for their responses
+void trans_clear(amdev_t * dev) {
+    timer_cancel(dev->sched, &dev->timers[TIMER_TRANS]);
+    trans_put(dev, dev->trans);
+    while (dev->trans_queue != NULL) {
+        amtrans_t * trans = dev->trans_queue;
+        dev->trans_queue = trans->next;
+        trans_put(dev, trans);
+    }
+    dev->trans = NULL;
+    dev->trans_tail = &dev->trans_queue;
+}
+
+// Drop the requests and the pool, device is closing
+void trans_free(amdev_t * dev) {
+    trans_clear(dev);
+    free(dev->trans_pool);
+    dev->trans_pool = NULL;
+    dev->trans_free = NULL;
+}
+
+// Send the next queued request, if nothing is outstanding
+static int trans_send_next(amdev_t * dev) {
+    if (dev->trans != NULL || dev->trans_queue == NULL)
+        return 0;
+    amtrans_t * trans = dev->trans_queue;
+    dev->trans_queue = trans->next;
+    if (dev->trans_queue == NULL)
+        dev->trans_tail = &dev->trans_queue;
+    trans->next = NULL;
+    dev->trans = trans;
+
+    ssize_t len = send(dev->sock, trans->pdu, trans->len, 0);
+    if (len < 0 || len != trans->len)
+        return -1;
+    return timer_set(dev->sched, &dev->timers[TIMER_TRANS], timer_now_ms() + trans->timeout_ms);
+}
+
+// Queue a request encoded in place, it is sent once the ones before it are answered
+// Inputs:
+//   len - size of the encoded request (0 if encoding failed)
+static int trans_queue(amdev_t * dev, amtrans_t * trans, uint16_t len, uint32_t timeout_ms, trans_done_t done) {
+    if (len == 0) {
+        trans_put(dev, trans);
+        return -1;
+    }
+    trans->opcode = trans->pdu[0];
+    trans->expected = opcode2expected(trans->pdu[0]);
+    trans->len = len;
+    trans->timeout_ms = timeout_ms;
+    trans->done = done;
+    trans->next = NULL;
+
+    *dev->trans_tail = trans;
+    dev->trans_tail = &trans->next;
+    return trans_send_next(dev);
+}
+
+// Queue a request, it is sent once the ones before it are answered
+// Inputs:
+//   pdu        - encoded request
+//   timeout_ms - time to wait for the response once sent
+//   done       - completion, called with the response
+int trans_request(amdev_t * dev, const uint8_t * pdu, uint16_t len, uint32_t timeout_ms, trans_done_t done) {
+    if (len == 0 || len > ATT_MTU_MAX)
+        return -1;
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    memcpy(trans->pdu, pdu, len);
+    return trans_queue(dev, trans, len, timeout_ms, done);
+}
+
+// Read a characteristic
+// Inputs:
+//   handle - characteristics handle to read from
+int trans_read(amdev_t * dev, uint16_t handle, trans_done_t done) {
+    if (handle == 0)
+        return -1;
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    uint16_t plen = enc_read_req(handle, trans->pdu, sizeof(trans->pdu));
+    return trans_queue(dev, trans, plen, TRANS_TIMEOUT_MS, done);
+}
+
+// Read several characteristics in one request
+//  values come back to back, only the last one may be of variable size
+// Inputs:
+//   handles - characteristics handles to read from
+//   num     - number of handles (at least 2)
+int trans_read_multi(amdev_t * dev, const uint16_t * handles, int num, trans_done_t done) {
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    uint16_t plen = enc_read_multi_req(handles, num, trans->pdu, dev->mtu);
+    return trans_queue(dev, trans, plen, TRANS_TIMEOUT_MS, done);
+}
+
+// Write to a characteristic with response
+// Inputs:
+//   handle - characteristics handle to write to
+//   value  - value to write
+//   vlen   - size of value in bytes
+int trans_write_req(amdev_t * dev, uint16_t handle, const uint8_t * value, size_t vlen, trans_done_t done) {
+    if (handle == 0)
+        return -1;
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    uint16_t plen = enc_write_req(handle, value, vlen, trans->pdu, dev->mtu);
+    return trans_queue(dev, trans, plen, TRANS_TIMEOUT_MS, done);
+}
+
+// Exchange MTU, must be the first request on a connection
+// Inputs:
+//   mtu - largest PDU this end can receive
+int trans_exchange_mtu(amdev_t * dev, uint16_t mtu, trans_done_t done) {
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    uint16_t plen = enc_mtu_req(mtu, trans->pdu, ATT_DEFAULT_LE_MTU);
+    return trans_queue(dev, trans, plen, TRANS_TIMEOUT_MS, done);
+}
+
+// Read attributes of given 16-bit type within a handle range
+int trans_read_by_type(amdev_t * dev, uint16_t start_handle, uint16_t end_handle, uint16_t type,
+        trans_done_t done) {
+    bt_uuid_t type_uuid;
+    bt_uuid16_create(&type_uuid, type);
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    uint16_t plen = enc_read_by_type_req(start_handle, end_handle, &type_uuid, trans->pdu, dev->mtu);
+    return trans_queue(dev, trans, plen, TRANS_TIMEOUT_MS, done);
+}
+
+// Find attributes of given 16-bit type with the given value within a handle range
+// Inputs:
+//   value - attribute value to look for
+//   vlen  - size of value in bytes
+int trans_find_by_type(amdev_t * dev, uint16_t start_handle, uint16_t end_handle, uint16_t type,
+        const uint8_t * value, size_t vlen, trans_done_t done) {
+    bt_uuid_t type_uuid;
+    bt_uuid16_create(&type_uuid, type);
+    amtrans_t * trans = trans_get(dev);
+    if (trans == NULL)
+        return -1;
+    uint16_t plen = enc_find_by_type_req(start_handle, end_handle, &type_uuid, value, vlen, trans->pdu, dev->mtu);
+    return trans_queue(dev, trans, plen, TRANS_TIMEOUT_MS, done);
+}
+
+// Complete the outstanding request with the response (or error) received
+// Outputs:
+//   returns 0 if handled, TRANS_UNMATCHED if not a response to the outstanding request,
+//   or -1 if the device should be dropped
+int trans_response(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
+    amtrans_t * trans = dev->trans;
+    if (trans == NULL || buflen < 1)
+        return TRANS_UNMATCHED;
+
+    uint8_t status = 0;
+    if (buf[0] == ATT_OP_ERROR) {
+        // Error response names the request it answers
+        if (buflen < 5 || buf[1] != trans->opcode)
+            return TRANS_UNMATCHED;
+        status = buf[4];
+    } else if (buf[0] != trans->expected) {
+        return TRANS_UNMATCHED;
+    }
+
+    timer_cancel(dev->sched, &dev->timers[TIMER_TRANS]);
+    dev->trans = NULL;
+    // Keep the pipe full, requests made upon completion queue after this one
+    int ret = trans_send_next(dev);
+    if (trans->done != NULL && trans->done(dev, status, buf, buflen))
+        ret = -1;
+    trans_put(dev, trans);
+    return ret;
+}
+
+// The outstanding request is not answered in time
+//  no more requests can be sent on this connection, so it should be dropped
+int trans_timeout(amdev_t * dev) {
+    amtrans_t * trans = dev->trans;
+    dev->trans = NULL;
+    if (trans != NULL) {
+        fprintf(stderr, "No response to %s in %s\n", att_op2str(trans->opcode), g_cfg.dst[dev->dev_idx]);
+        if (trans->done != NULL)
+            trans->done(dev, ATT_ECODE_TIMEOUT, NULL, 0);
+        trans_put(dev, trans);
+    }
+    trans_clear(dev);
+    return -1;
+}
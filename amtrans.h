@@ -0,0 +1,57 @@
+/*
+ * Amiigo Link ATT client transactions
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMTRANS_H
+#define AMTRANS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "amdev.h"
+
+#define TRANS_TIMEOUT_MS 30000 // ATT transaction time out (Core spec Vol 3, Part F, 3.3.3)
+#define TRANS_UNMATCHED 1      // PDU is not the response of the outstanding request
+#define TRANS_POOL_SIZE 8      // Requests preallocated per device
+
+// Request completion
+// Inputs:
+//   status - 0 on success, the ATT error code, or ATT_ECODE_TIMEOUT
+//   buf    - the response PDU (NULL on time out)
+// Outputs:
+//   returns non-zero if the device should be dropped
+typedef int (*trans_done_t)(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+
+// A request waiting for its response
+typedef struct _amtrans {
+    uint8_t opcode;                   // Request opcode
+    uint8_t expected;                 // Response opcode
+    uint16_t len;                     // Size of the request PDU
+    uint32_t timeout_ms;              // Time to wait for the response once sent
+    trans_done_t done;                // Called upon response or time out
+    struct _amtrans * next;
+    uint8_t pdu[ATT_MTU_MAX];         // Request PDU
+} amtrans_t;
+
+int trans_init(amdev_t * dev);
+void trans_clear(amdev_t * dev);
+void trans_free(amdev_t * dev);
+
+int trans_request(amdev_t * dev, const uint8_t * pdu, uint16_t len, uint32_t timeout_ms, trans_done_t done);
+int trans_exchange_mtu(amdev_t * dev, uint16_t mtu, trans_done_t done);
+int trans_read(amdev_t * dev, uint16_t handle, trans_done_t done);
+int trans_read_multi(amdev_t * dev, const uint16_t * handles, int num, trans_done_t done);
+int trans_write_req(amdev_t * dev, uint16_t handle, const uint8_t * value, size_t vlen, trans_done_t done);
+int trans_read_by_type(amdev_t * dev, uint16_t start_handle, uint16_t end_handle, uint16_t type,
+        trans_done_t done);
+int trans_find_by_type(amdev_t * dev, uint16_t start_handle, uint16_t end_handle, uint16_t type,
+        const uint8_t * value, size_t vlen, trans_done_t done);
+
+int trans_response(amdev_t * dev, uint8_t * buf, ssize_t buflen);
+int trans_timeout(amdev_t * dev);
+
+#endif // include guard
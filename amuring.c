@@ -0,0 +1,381 @@
+/*
+ * Amiigo Link io_uring backend (raw syscalls)
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  no liburing, the rings are mapped and driven with plain syscalls
+ *  receives are multishot, the kernel picks a buffer from a registered ring
+ *   for each PDU, so one submission keeps a socket receiving until it closes
+ *  log files are written through a stdio cookie, each full stdio buffer
+ *   becomes one write submission, submitted together with the others
+ *
+ */
+
+#define _GNU_SOURCE // for fopencookie()
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "amuring.h"
+
+#define URING_WRITE_CHUNK (64 * 1024) // stdio buffer of log files, the size of each write
+#define URING_MAX_INFLIGHT 64 // Most log writes in flight before waiting for some
+
+// Log file written through the ring
+typedef struct _uring_file {
+    amuring_t * ring;
+    int fd;
+    uint64_t off;                     // Where the next write goes
+} uring_file_t;
+
+// Data of a single write in flight
+typedef struct _uring_chunk {
+    uint32_t len;
+    uint8_t data[];
+} uring_chunk_t;
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params * p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, uint32_t opcode, void * arg, uint32_t nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Set up the rings
+// Inputs:
+//   entries   - submission queue size
+//   buf_count - number of receive buffers to register (power of two), 0 if not receiving
+//   buf_len   - size of each receive buffer
+int uring_init(amuring_t * ring, uint32_t entries, uint32_t buf_count, uint32_t buf_len) {
+    struct io_uring_params p;
+    uint32_t i;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 2 * (entries > buf_count ? entries : buf_count);
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0) {
+        fprintf(stderr, "io_uring_setup() error (%d)\n", errno);
+        ring->fd = -1;
+        return -1;
+    }
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = 0;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        goto fail;
+    }
+    ring->cq_ptr = ring->sq_ptr;
+    if (ring->cq_len) {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    uint8_t * sq = ring->sq_ptr;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_head = (uint32_t *)(sq + p.sq_off.head);
+    ring->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+    ring->sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+    ring->sq_flags = (uint32_t *)(sq + p.sq_off.flags);
+    ring->sq_array = (uint32_t *)(sq + p.sq_off.array);
+    uint8_t * cq = ring->cq_ptr;
+    ring->cq_head = (uint32_t *)(cq + p.cq_off.head);
+    ring->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+    ring->cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+
+    if (buf_count == 0)
+        return 0;
+
+    // Register the receive buffers
+    ring->br_len = buf_count * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->br == MAP_FAILED) {
+        ring->br = NULL;
+        goto fail;
+    }
+    ring->bufs = malloc(buf_count * buf_len);
+    if (ring->bufs == NULL)
+        goto fail;
+    ring->buf_count = buf_count;
+    ring->buf_len = buf_len;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+    reg.ring_entries = buf_count;
+    reg.bgid = 0;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto fail;
+    for (i = 0; i < buf_count; ++i) {
+        struct io_uring_buf * buf = &ring->br->bufs[i];
+        buf->addr = (uint64_t)(uintptr_t)&ring->bufs[i * buf_len];
+        buf->len = buf_len;
+        buf->bid = i;
+    }
+    ring->br_tail = buf_count;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+
+    return 0;
+
+fail:
+    fprintf(stderr, "io_uring setup error (%d)\n", errno);
+    uring_close(ring);
+    return -1;
+}
+
+// Tear down the rings, anything in flight is abandoned
+void uring_close(amuring_t * ring) {
+    if (ring->fd >= 0)
+        close(ring->fd);
+    ring->fd = -1;
+    if (ring->br != NULL)
+        munmap(ring->br, ring->br_len);
+    ring->br = NULL;
+    free(ring->bufs);
+    ring->bufs = NULL;
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_len);
+    ring->sqes = NULL;
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    ring->cq_ptr = NULL;
+    if (ring->sq_ptr != NULL)
+        munmap(ring->sq_ptr, ring->sq_len);
+    ring->sq_ptr = NULL;
+}
+
+// Get the next free submission entry, submitting the queued ones if full
+static struct io_uring_sqe * uring_sqe(amuring_t * ring) {
+    uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        if (uring_submit(ring, 0))
+            return NULL;
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->sq_entries)
+            return NULL;
+    }
+    uint32_t idx = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe * sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// Queue a multishot receive on a socket, completions carry user_data
+//  each completion is a single PDU in one of the registered buffers
+int uring_recv(amuring_t * ring, int sock, uint64_t user_data) {
+    struct io_uring_sqe * sqe = uring_sqe(ring);
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sock;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = 0;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+// Queue cancellation of the request with given user_data
+//  the cancellation itself completes with user_data of 0
+int uring_cancel(amuring_t * ring, uint64_t user_data) {
+    struct io_uring_sqe * sqe = uring_sqe(ring);
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = 0;
+    return 0;
+}
+
+// Submit the queued entries
+// Inputs:
+//   wait_nr - number of completions to wait for
+int uring_submit(amuring_t * ring, uint32_t wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    uint32_t to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    uint32_t flags = 0;
+    // Completions that did not fit are flushed to the ring upon entering
+    if (wait_nr || (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+        flags |= IORING_ENTER_GETEVENTS;
+    if (to_submit == 0 && flags == 0)
+        return 0;
+    for (;;) {
+        int ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+        if (ret >= 0 || errno == EBUSY)
+            return 0;
+        if (errno != EINTR) {
+            fprintf(stderr, "io_uring_enter() error (%d)\n", errno);
+            return -1;
+        }
+    }
+}
+
+// Peek the next completion
+// Outputs:
+//   returns the completion, or NULL if none is ready
+struct io_uring_cqe * uring_cqe(amuring_t * ring) {
+    uint32_t head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+// Done with the completion returned by uring_cqe
+void uring_cqe_seen(amuring_t * ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Received data of a completion, or NULL if it has none
+uint8_t * uring_buf(amuring_t * ring, const struct io_uring_cqe * cqe) {
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return NULL;
+    return &ring->bufs[(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * ring->buf_len];
+}
+
+// Give the buffer of a completion back to the kernel for the next receive
+void uring_buf_return(amuring_t * ring, const struct io_uring_cqe * cqe) {
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return;
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    struct io_uring_buf * buf = &ring->br->bufs[ring->br_tail & (ring->buf_count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)&ring->bufs[bid * ring->buf_len];
+    buf->len = ring->buf_len;
+    buf->bid = bid;
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+// Release the writes that are complete
+void uring_reap(amuring_t * ring) {
+    struct io_uring_cqe * cqe;
+    while ((cqe = uring_cqe(ring)) != NULL) {
+        uring_chunk_t * chunk = (uring_chunk_t *)(uintptr_t)cqe->user_data;
+        if (chunk != NULL) {
+            if (cqe->res != (int)chunk->len)
+                fprintf(stderr, "Log write error (%d)\n", cqe->res < 0 ? -cqe->res : 0);
+            free(chunk);
+            ring->inflight--;
+        }
+        uring_cqe_seen(ring);
+    }
+}
+
+// stdio flushing a log file buffer
+static ssize_t uring_file_write(void * cookie, const char * buf, size_t size) {
+    uring_file_t * file = cookie;
+    amuring_t * ring = file->ring;
+
+    // Bound the memory held by writes in flight
+    while (ring->inflight >= URING_MAX_INFLIGHT) {
+        if (uring_submit(ring, 1))
+            return -1;
+        uring_reap(ring);
+    }
+    uring_chunk_t * chunk = malloc(sizeof(uring_chunk_t) + size);
+    if (chunk == NULL)
+        return -1;
+    chunk->len = size;
+    memcpy(chunk->data, buf, size);
+    struct io_uring_sqe * sqe = uring_sqe(ring);
+    if (sqe == NULL) {
+        free(chunk);
+        return -1;
+    }
+    // Explicit offsets keep the file intact however the writes complete
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = file->fd;
+    sqe->addr = (uint64_t)(uintptr_t)chunk->data;
+    sqe->len = size;
+    sqe->off = file->off;
+    sqe->user_data = (uint64_t)(uintptr_t)chunk;
+    file->off += size;
+    ring->inflight++;
+    return size;
+}
+
+// stdio closing a log file, wait for its data to land first
+static int uring_file_close(void * cookie) {
+    uring_file_t * file = cookie;
+    amuring_t * ring = file->ring;
+    int ret = 0;
+    while (ring->inflight > 0) {
+        if (uring_submit(ring, 1)) {
+            ret = -1;
+            break;
+        }
+        uring_reap(ring);
+    }
+    if (close(file->fd))
+        ret = -1;
+    free(file);
+    return ret;
+}
+
+// Open a log file whose writes go through the ring
+//  writes are submitted with the next uring_submit, or once the ring fills
+// Inputs:
+//   append - if should write to the end instead of truncating
+FILE * uring_fopen(amuring_t * ring, const char * path, int append) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0644);
+    if (fd < 0)
+        return NULL;
+    uring_file_t * file = calloc(1, sizeof(uring_file_t));
+    if (file == NULL) {
+        close(fd);
+        return NULL;
+    }
+    file->ring = ring;
+    file->fd = fd;
+    if (append) {
+        off_t end = lseek(fd, 0, SEEK_END);
+        file->off = end > 0 ? end : 0;
+    }
+    cookie_io_functions_t funcs = {NULL, uring_file_write, NULL, uring_file_close};
+    FILE * fp = fopencookie(file, "w", funcs);
+    if (fp == NULL) {
+        close(fd);
+        free(file);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, URING_WRITE_CHUNK);
+    return fp;
+}
@@ -0,0 +1,64 @@
+/*
+ * Amiigo Link io_uring backend (raw syscalls)
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ */
+
+#ifndef AMURING_H
+#define AMURING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// A single io_uring instance, only to be used by one thread at a time
+typedef struct _amuring {
+    int fd;                           // io_uring file descriptor (-1 if not set up)
+    // Submission queue
+    uint32_t sq_entries;              // Number of submission entries
+    uint32_t * sq_head;               // Consumed by the kernel
+    uint32_t * sq_tail;               // Produced by us
+    uint32_t * sq_mask;
+    uint32_t * sq_flags;
+    uint32_t * sq_array;
+    struct io_uring_sqe * sqes;
+    uint32_t sqe_tail;                // Entries prepared so far (published upon submit)
+    // Completion queue
+    uint32_t * cq_head;               // Consumed by us
+    uint32_t * cq_tail;               // Produced by the kernel
+    uint32_t * cq_mask;
+    struct io_uring_cqe * cqes;
+    // Mappings
+    void * sq_ptr;
+    size_t sq_len;
+    void * cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+    // Receive buffers the kernel picks from (multishot receive)
+    struct io_uring_buf_ring * br;
+    size_t br_len;
+    uint8_t * bufs;
+    uint32_t buf_count;               // Number of buffers (power of two)
+    uint32_t buf_len;                 // Size of each buffer
+    uint16_t br_tail;                 // Buffers handed to the kernel so far
+    uint32_t inflight;                // Writes submitted and not yet completed
+} amuring_t;
+
+int uring_init(amuring_t * ring, uint32_t entries, uint32_t buf_count, uint32_t buf_len);
+void uring_close(amuring_t * ring);
+
+int uring_recv(amuring_t * ring, int sock, uint64_t user_data);
+int uring_cancel(amuring_t * ring, uint64_t user_data);
+int uring_submit(amuring_t * ring, uint32_t wait_nr);
+
+struct io_uring_cqe * uring_cqe(amuring_t * ring);
+void uring_cqe_seen(amuring_t * ring);
+uint8_t * uring_buf(amuring_t * ring, const struct io_uring_cqe * cqe);
+void uring_buf_return(amuring_t * ring, const struct io_uring_cqe * cqe);
+
+FILE * uring_fopen(amuring_t * ring, const char * path, int append);
+void uring_reap(amuring_t * ring);
+
+#endif // include guard
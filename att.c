@@ -532,6 +532,37 @@ struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len) {
     return list;
 }
 
+uint16_t dec_read_by_type_resp_iter(const uint8_t *pdu, size_t len,
+        struct att_data_iter *iter) {
+    uint16_t num;
+
+    if (pdu == NULL || iter == NULL)
+        return 0;
+
+    if (len < 2 || pdu[0] != ATT_OP_READ_BY_TYPE_RESP || pdu[1] == 0)
+        return 0;
+
+    /* Partial entry at the end is ignored */
+    num = (len - 2) / pdu[1];
+    iter->len = pdu[1];
+    iter->ptr = &pdu[2];
+    iter->end = iter->ptr + num * iter->len;
+
+    return num;
+}
+
+const uint8_t *att_data_iter_next(struct att_data_iter *iter) {
+    const uint8_t *data;
+
+    if (iter->ptr >= iter->end)
+        return NULL;
+
+    data = iter->ptr;
+    iter->ptr += iter->len;
+
+    return data;
+}
+
 uint16_t enc_write_cmd(uint16_t handle, const uint8_t *value, size_t vlen,
         uint8_t *pdu, size_t len) {
     const uint16_t min_len = sizeof(pdu[0]) + sizeof(handle);
@@ -678,6 +709,27 @@ uint16_t enc_read_blob_req(uint16_t handle, uint16_t offset, uint8_t *pdu,
     return min_len;
 }
 
+uint16_t enc_read_multi_req(const uint16_t *handles, int num, uint8_t *pdu,
+        size_t len) {
+    const uint16_t min_len = sizeof(pdu[0]) + 2 * sizeof(handles[0]);
+    uint16_t plen = sizeof(pdu[0]);
+    int i;
+
+    if (pdu == NULL || handles == NULL)
+        return 0;
+
+    if (num < 2 || len < min_len || len < plen + num * sizeof(handles[0]))
+        return 0;
+
+    pdu[0] = ATT_OP_READ_MULTI_REQ;
+    for (i = 0; i < num; i++) {
+        att_put_u16(handles[i], &pdu[plen]);
+        plen += sizeof(handles[0]);
+    }
+
+    return plen;
+}
+
 uint16_t dec_read_req(const uint8_t *pdu, size_t len, uint16_t *handle) {
     const uint16_t min_len = sizeof(pdu[0]) + sizeof(*handle);
 
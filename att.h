@@ -252,6 +252,13 @@ struct att_data_list {
     uint8_t **data;
 };
 
+/* Walks the entries of a response in place, without copying them */
+struct att_data_iter {
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint16_t len;
+};
+
 struct att_range {
     uint16_t start;
     uint16_t end;
@@ -384,6 +391,9 @@ uint16_t enc_write_cmd(uint16_t handle, const uint8_t *value, size_t vlen,
 uint16_t dec_write_cmd(const uint8_t *pdu, size_t len, uint16_t *handle,
         uint8_t *value, size_t *vlen);
 struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len);
+uint16_t dec_read_by_type_resp_iter(const uint8_t *pdu, size_t len,
+        struct att_data_iter *iter);
+const uint8_t *att_data_iter_next(struct att_data_iter *iter);
 uint16_t enc_write_req(uint16_t handle, const uint8_t *value, size_t vlen,
         uint8_t *pdu, size_t len);
 uint16_t dec_write_req(const uint8_t *pdu, size_t len, uint16_t *handle,
@@ -393,6 +403,8 @@ uint16_t dec_write_resp(const uint8_t *pdu, size_t len);
 uint16_t enc_read_req(uint16_t handle, uint8_t *pdu, size_t len);
 uint16_t enc_read_blob_req(uint16_t handle, uint16_t offset, uint8_t *pdu,
         size_t len);
+uint16_t enc_read_multi_req(const uint16_t *handles, int num, uint8_t *pdu,
+        size_t len);
 uint16_t dec_read_req(const uint8_t *pdu, size_t len, uint16_t *handle);
 uint16_t dec_read_blob_req(const uint8_t *pdu, size_t len, uint16_t *handle,
         uint16_t *offset);
@@ -0,0 +1,160 @@
+/*
+ * Amiigo Link log sink benchmark
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  feeds a long accel capture (a timestamp every 64 samples) through the JSON sink,
+ *  and through the printf forms it replaced, then checks both logs are identical
+ *  the sink is flushed every FLUSH_RECORDS records, as the decoder does after each drain
+ *  build with "make bench", run from a writable directory:
+ *    ./sink_bench [records] [console]
+ *  with console non-zero accel lines are echoed to an unbuffered /dev/null stdout as well
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "amdev.h"
+#include "amsink.h"
+
+#define DEFAULT_RECORDS 20000000 // Records in the capture
+#define TIMESTAMP_EVERY 64       // Accel samples between timestamps
+#define FLUSH_RECORDS 256        // Records decoded per drain
+
+aml_options_t g_opt;
+char g_szBaseName[256];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Record n of the capture, accel walks slowly as a worn device does
+static void capture_record(uint32_t n, int8_t * walk, amrecord_t * rec) {
+    int i;
+    if (n % (TIMESTAMP_EVERY + 1) == 0) {
+        rec->type = RECORD_TIMESTAMP;
+        rec->time.timestamp = 1000000 + n;
+        rec->time.flags = 0;
+        return;
+    }
+    rec->type = RECORD_ACCEL;
+    for (i = 0; i < 3; ++i) {
+        walk[i] += (int8_t)(((n * 2654435761u) >> (8 * i + 5)) % 7) - 3;
+        rec->accel.accel[i] = walk[i];
+    }
+}
+
+// The printf forms the sink used before
+static void printf_record(FILE * fp, const amrecord_t * rec) {
+    char log_line[512] = {0};
+    switch (rec->type) {
+    case RECORD_TIMESTAMP:
+        fprintf(fp, "[\"timestamp\",[%u,%u]]\n", rec->time.timestamp, rec->time.flags);
+        break;
+    case RECORD_ACCEL:
+        sprintf(log_line, "[\"accelerometer\",[%d,%d,%d]]\n", rec->accel.accel[0], rec->accel.accel[1],
+                rec->accel.accel[2]);
+        fputs(log_line, fp);
+        if (g_opt.console) {
+            fputs(log_line, stdout);
+            fflush(stdout);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Compare two files
+// Outputs:
+//   returns 0 if identical
+static int same_files(const char * szA, const char * szB) {
+    FILE * fa = fopen(szA, "r");
+    FILE * fb = fopen(szB, "r");
+    int ret = -1;
+    if (fa != NULL && fb != NULL) {
+        char a[4096], b[4096];
+        size_t la, lb;
+        do {
+            la = fread(a, 1, sizeof(a), fa);
+            lb = fread(b, 1, sizeof(b), fb);
+        } while (la == lb && la > 0 && memcmp(a, b, la) == 0);
+        ret = (la == 0 && lb == 0) ? 0 : -1;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return ret;
+}
+
+int main(int argc, char * argv[]) {
+    uint32_t records = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_RECORDS;
+    uint32_t n, accels = 0;
+    int8_t walk[3];
+    amrecord_t rec;
+
+    g_opt.console = argc > 2 ? atoi(argv[2]) : 0;
+    if (g_opt.console) {
+        // Unbuffered as amlink has it
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            return 1;
+        setbuf(stdout, NULL);
+    }
+    strcpy(g_szBaseName, "sink_bench_json.log");
+
+    for (n = 0; n < records; ++n)
+        accels += (n % (TIMESTAMP_EVERY + 1)) != 0;
+
+    // printf forms
+    FILE * fp = fopen("sink_bench_printf.log", "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot create sink_bench_printf.log\n");
+        return 1;
+    }
+    memset(walk, 0, sizeof(walk));
+    uint64_t start = now_ns();
+    for (n = 0; n < records; ++n) {
+        capture_record(n, walk, &rec);
+        printf_record(fp, &rec);
+    }
+    fclose(fp);
+    uint64_t printf_ns = now_ns() - start;
+
+    // JSON sink
+    amdev_t * dev = calloc(1, sizeof(amdev_t));
+    if (dev == NULL)
+        return 1;
+    memset(walk, 0, sizeof(walk));
+    start = now_ns();
+    for (n = 0; n < records; ++n) {
+        capture_record(n, walk, &rec);
+        g_sink_json.record(dev, &rec);
+        if (n % FLUSH_RECORDS == FLUSH_RECORDS - 1)
+            g_sink_json.flush(dev);
+    }
+    g_sink_json.close(dev);
+    uint64_t sink_ns = now_ns() - start;
+    free(dev);
+
+    int same = same_files("sink_bench_printf.log", "sink_bench_json.log") == 0;
+    fprintf(stderr, "%u records (%u accel), console %s\n", records, accels, g_opt.console ? "on" : "off");
+    fprintf(stderr, "  printf forms: %6.1f ns per record\n", (double)printf_ns / records);
+    fprintf(stderr, "  JSON sink:    %6.1f ns per record\n", (double)sink_ns / records);
+    fprintf(stderr, "  logs %s\n", same ? "identical" : "DIFFER");
+    unlink("sink_bench_printf.log");
+    unlink("sink_bench_json.log");
+    return same ? 0 : 1;
+}
@@ -18,7 +18,6 @@
 
 AMIIGO_CMD g_cmd = AMIIGO_CMD_NONE;
 amcfg_t g_cfg;
-extern char g_src[512];
 
 // Initialize the command configs to defaults
 void cmd_init(void) {
@@ -29,6 +28,10 @@ void cmd_init(void) {
     g_cfg.maint_led.duration = 5;
     g_cfg.maint_led.led = 6;
     g_cfg.maint_led.speed = 1;
+
+    // Default adapter
+    g_cfg.src[0] = "hci0";
+    g_cfg.count_src = 1;
 }
 
 void trim(char *str)
@@ -50,39 +53,48 @@ void trim(char *str)
     str[i - begin] = '\0'; // Null terminate string.
 }
 
+// Find the command by its name
+// Outputs:
+//   returns the command, or -1 if invalid
+int command_from_name(const char * szName) {
+    if (strcasecmp(szName, "download") == 0)
+        return AMIIGO_CMD_DOWNLOAD;
+    if (strcasecmp(szName, "resetcpu") == 0)
+        return AMIIGO_CMD_RESET_CPU;
+    if (strcasecmp(szName, "resetlogs") == 0)
+        return AMIIGO_CMD_RESET_LOGS;
+    if (strcasecmp(szName, "resetconfigs") == 0)
+        return AMIIGO_CMD_RESET_CONFIGS;
+    if (strcasecmp(szName, "configls") == 0)
+        return AMIIGO_CMD_CONFIGLS;
+    if (strcasecmp(szName, "configaccel") == 0)
+        return AMIIGO_CMD_CONFIGACCEL;
+    if (strcasecmp(szName, "configtemp") == 0)
+        return AMIIGO_CMD_CONFIGTEMP;
+    if (strcasecmp(szName, "blink") == 0)
+        return AMIIGO_CMD_BLINK;
+    if (strcasecmp(szName, "deepsleep") == 0)
+        return AMIIGO_CMD_DEEPSLEEP;
+    if (strcasecmp(szName, "status") == 0)
+        return AMIIGO_CMD_NONE;
+    if (strcasecmp(szName, "rename") == 0)
+        return AMIIGO_CMD_RENAME;
+    if (strcasecmp(szName, "tag") == 0)
+        return AMIIGO_CMD_TAG;
+    if (strcasecmp(szName, "test_seq") == 0)
+        return AMIIGO_CMD_TEST_SEQ;
+    if (strcasecmp(szName, "extstatus") == 0)
+        return AMIIGO_CMD_EXTSTATUS;
+    return -1;
+}
+
 int parse_command(const char * szName) {
-    if (strcasecmp(szName, "download") == 0) {
-        g_cmd = AMIIGO_CMD_DOWNLOAD;
-    } else if (strcasecmp(szName, "resetcpu") == 0) {
-        g_cmd = AMIIGO_CMD_RESET_CPU;
-    } else if (strcasecmp(szName, "resetlogs") == 0) {
-        g_cmd = AMIIGO_CMD_RESET_LOGS;
-    } else if (strcasecmp(szName, "resetconfigs") == 0) {
-        g_cmd = AMIIGO_CMD_RESET_CONFIGS;
-    } else if (strcasecmp(szName, "configls") == 0) {
-        g_cmd = AMIIGO_CMD_CONFIGLS;
-    } else if (strcasecmp(szName, "configaccel") == 0) {
-        g_cmd = AMIIGO_CMD_CONFIGACCEL;
-    } else if (strcasecmp(szName, "configtemp") == 0) {
-        g_cmd = AMIIGO_CMD_CONFIGTEMP;
-    } else if (strcasecmp(szName, "blink") == 0) {
-        g_cmd = AMIIGO_CMD_BLINK;
-    } else if (strcasecmp(szName, "deepsleep") == 0) {
-        g_cmd = AMIIGO_CMD_DEEPSLEEP;
-    } else if (strcasecmp(szName, "status") == 0) {
-        g_cmd = AMIIGO_CMD_NONE;
-    } else if (strcasecmp(szName, "rename") == 0) {
-        g_cmd = AMIIGO_CMD_RENAME;
-    } else if (strcasecmp(szName, "tag") == 0) {
-        g_cmd = AMIIGO_CMD_TAG;
-    } else if (strcasecmp(szName, "test_seq") == 0) {
-        g_cmd = AMIIGO_CMD_TEST_SEQ;
-    } else if (strcasecmp(szName, "extstatus") == 0) {
-        g_cmd = AMIIGO_CMD_EXTSTATUS;
-    } else {
+    int cmd = command_from_name(szName);
+    if (cmd < 0) {
         fprintf(stderr, "Invalid command (%s)!\n", szName);
         return -1;
     }
+    g_cmd = cmd;
     return 0;
 }
 
@@ -104,7 +116,28 @@ int parse_mode(const char * szName) {
 }
 
 int parse_adapter(const char * szName) {
-    strcpy(g_src, szName);
+
+    char * str = strdup(szName);
+
+    char * pch;
+    pch = strtok (str, ",");
+    int src_count = 0;
+    while (pch != NULL) {
+        if (src_count >= MAX_SRC_COUNT) {
+            fprintf(stderr, "Maximum of %d adapters can be used\n", MAX_SRC_COUNT);
+            free(str);
+            return -1;
+        }
+        g_cfg.src[src_count] = pch;
+        src_count++;
+        pch = strtok (NULL, ",");
+    }
+    if (src_count == 0) {
+        fprintf(stderr, "Invalid adapter (%s)!\n", szName);
+        free(str);
+        return -1;
+    }
+    g_cfg.count_src = src_count;
     return 0;
 }
 
@@ -116,9 +149,16 @@ int parse_device(const char * szName) {
     pch = strtok (str, ",");
     int dev_count = 0;
     while (pch != NULL) {
-        if (dev_count >= MAX_DEV_COUNT) {
-            fprintf(stderr, "Maximum of %d devices can be connected to\n", MAX_DEV_COUNT);
-            return -1;
+        if (dev_count >= g_cfg.alloc_dst) {
+            // Grow the device table
+            int alloc_dst = g_cfg.alloc_dst ? 2 * g_cfg.alloc_dst : 16;
+            char ** dst = realloc(g_cfg.dst, alloc_dst * sizeof(char *));
+            if (dst == NULL) {
+                fprintf(stderr, "Not enough memory for %d devices\n", alloc_dst);
+                return -1;
+            }
+            g_cfg.dst = dst;
+            g_cfg.alloc_dst = alloc_dst;
         }
         g_cfg.dst[dev_count] = pch;
         dev_count++;
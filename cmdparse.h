@@ -12,6 +12,7 @@
 void cmd_init(void);
 
 int parse_file_exists(const char * szName);
+int command_from_name(const char * szName);
 int parse_command(const char * szName);
 int parse_adapter(const char * szName);
 int parse_device(const char * szName);
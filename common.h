@@ -11,6 +11,8 @@
 
 #define FW_VERSION(Major, Minor, Build) (Major * 100000u + Minor * 1000u + Build)
 
+#define DEFAULT_MAX_LINKS 8 // Concurrent connections per adapter most controllers can handle
+
 typedef struct _aml_options {
     int leave_compressed; // If packets should be left in compressed form
     int raw;              // If should download logs in raw format (no compression in firmware)
@@ -19,6 +21,12 @@ typedef struct _aml_options {
     int console;          // if should print accel to console
     int append;           // if should append instead of creating new files
     int full;             // If full characteristcs should be discovered
+    int max_links;        // Maximum number of concurrent connections per adapter
+    const char * ctl_path; // Control socket to serve requests on (daemon mode), NULL otherwise
+    int uring;            // If should receive and write logs through io_uring
+    int fast;             // If should download at the shortest connection interval
+    int whitelist;        // If the adapter should connect to devices through its whitelist
+    const char * cache_path; // GATT handle cache file, NULL if disabled
 } aml_options_t;
 
 extern aml_options_t g_opt;
@@ -4,6 +4,15 @@
  * @date March 10, 2014
  * @author: dashesy
  * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  data blocks are written without response, paced by the socket send queue:
+ *  the send buffer is kept small so a full queue fails the write (EAGAIN),
+ *  the block is then sent again once the socket is writable
+ *  the image is read once and shared, each device keeps its own place in it,
+ *  so devices of different sessions can be updated at the same time
+ *
  */
 
 #include <errno.h>
@@ -22,37 +31,51 @@
 #include "amdev.h"
 #include "amchar.h"
 #include "gapproto.h"
+#include "amtrans.h"
 #include "amcmd.h"
+#include "amsession.h"
+#include "fwupdate.h"
 
 #define FWUP_HDR_ID 0x0101
+#define FWUP_POLL_MS 10 // Time between status polls while firmware is busy
+#define FWUP_TX_WINDOW 4096 // Send buffer during update, bounds blocks not yet taken by the controller
+
+// What to send next, once the socket can take it
+typedef enum _FWUP_TX {
+    FWUP_TX_BLOCKS = 0, // Data blocks of this round
+    FWUP_TX_DONE,       // Data done command
+    FWUP_TX_POLL,       // Status read
+} FWUP_TX;
 
 uint32_t g_fwup_speedup = 1; // How much to overload firmware update
 
-FILE * g_fwImageFile = NULL; // Firmware image file
+uint8_t * g_fwImage = NULL; // Firmware image, read only once loaded
 uint32_t g_fwImageSize = 0; // Firmware image size in bytes
-uint32_t g_fwImageWrittenSize = 0; // bytes transmitted
 uint16_t g_fwImagePage = 0; // Firmwate image total pages
-uint16_t g_fwImageWrittenPage = 0; // pages transmitted
 
 int set_update_file(const char * szName) {
-    g_fwImageFile = fopen(szName, "r");
-    if (g_fwImageFile == NULL) {
+    FILE * fp = fopen(szName, "r");
+    if (fp == NULL) {
         fprintf(stderr, "Firmware image file (%s) not accessible!\n", szName);
         return -1;
     }
-    fseek(g_fwImageFile, 0, SEEK_END);
-    g_fwImageSize = ftell(g_fwImageFile);
-    fseek(g_fwImageFile, 0, SEEK_SET);
+    fseek(fp, 0, SEEK_END);
+    g_fwImageSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
     if (g_fwImageSize < WED_FW_HEADER_SIZE) {
         fprintf(stderr, "Firmware image file (%s) too small!\n", szName);
+        fclose(fp);
+        return -1;
+    }
+    g_fwImage = malloc(g_fwImageSize);
+    if (g_fwImage == NULL || fread(g_fwImage, g_fwImageSize, 1, fp) != 1) {
+        fprintf(stderr, "Firmware image file (%s) not readable!\n", szName);
+        fclose(fp);
         return -1;
     }
-    WEDFirmwareCommand fwcmd;
-    memset(&fwcmd, 0, sizeof(fwcmd));
-    fwcmd.pkt_type = WED_FIRMWARE_INIT;
-    fread(fwcmd.header, WED_FW_HEADER_SIZE, 1, g_fwImageFile);
+    fclose(fp);
 
-    uint16_t * hdr = (uint16_t *) &fwcmd.header[0];
+    uint16_t * hdr = (uint16_t *) &g_fwImage[0];
     // TODO: check CRC
     //uint16_t fw_crc = hdr[0];
     uint16_t fw_id = hdr[1];
@@ -68,23 +91,21 @@ int set_update_file(const char * szName) {
         return -1;
     }
 
-    g_fwImageWrittenSize = 0;
-    g_fwImageWrittenPage = 0;
-    fseek(g_fwImageFile, 0, SEEK_SET);
-
     g_cmd = AMIIGO_CMD_FWUPDATE;
     return 0;
 }
 
 // Firmware update in progress
-int process_fwstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
+int process_fwstatus(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
     int ret = 0;
+    if (status)
+        return -1;
     WEDFirmwareStatus fwstatus;
     memset(&fwstatus, 0, sizeof(fwstatus));
     fwstatus.status = buf[1];
     fwstatus.error_code = buf[2];
 
-    uint16_t handle = g_char[AMIIGO_UUID_FIRMWARE].value_handle;
+    uint16_t handle = dev->chars[AMIIGO_UUID_FIRMWARE].value_handle;
 
     if (dev->state == STATE_FWSTATUS)
     {
@@ -103,17 +124,21 @@ int process_fwstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
             WEDFirmwareCommand fwcmd;
             memset(&fwcmd, 0, sizeof(fwcmd));
             fwcmd.pkt_type = WED_FIRMWARE_INIT;
-            fread(fwcmd.header, WED_FW_HEADER_SIZE, 1, g_fwImageFile);
-            fseek(g_fwImageFile, 0, SEEK_SET);
-            g_fwImageWrittenSize = 0;
+            memcpy(fwcmd.header, g_fwImage, WED_FW_HEADER_SIZE);
+            dev->fw_written = 0;
+            dev->fw_page = 0;
 
-            ret = exec_write(dev->sock, handle, (uint8_t *) &fwcmd, sizeof(fwcmd));
+            // Writes should fail rather than pile up in the kernel
+            if (gap_send_window(dev->sock, FWUP_TX_WINDOW))
+                return -1;
+            ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &fwcmd, sizeof(fwcmd));
             if (ret)
                 return -1;
             // We have already written the header
             dev->state = STATE_FWSTATUS_WAIT;
         }
-        ret = exec_read(dev->sock, handle); // Continue polling
+        // Continue polling once firmware had some time
+        ret = timer_set(dev->sched, &dev->timers[TIMER_FWPOLL], timer_now_ms() + FWUP_POLL_MS);
     } else if (fwstatus.status == WED_FWSTATUS_ERROR) {
         switch (fwstatus.error_code) {
         case WED_FWERROR_HEADER:
@@ -137,65 +162,12 @@ int process_fwstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
         }
         ret = -1;
     } else if (fwstatus.status == WED_FWSTATUS_UPLOAD_READY) {
-
-        int bRetry = 0;
-        int bFinished = 0;
-        int i, j;
-        for (j = 0; j < g_fwup_speedup && !bFinished && !bRetry; ++j)
-        {
-            for (i = 0; i < WED_FW_STREAM_BLOCKS; ++i) {
-                WEDFirmwareCommand fwdata;
-                memset(&fwdata, 0, sizeof(fwdata));
-                fwdata.pkt_type = WED_FIRMWARE_DATA_BLOCK;
-                long int offset = ftell(g_fwImageFile);
-                size_t len = fread(fwdata.data, 1, WED_FW_BLOCK_SIZE, g_fwImageFile);
-                if (len == 0) {
-                    bFinished = 1;
-                    if (g_opt.verbosity)
-                        printf("(ended)\n");
-                    break;
-                }
-                if (len < WED_FW_BLOCK_SIZE) {
-                    bFinished = 1;
-                    printf("(uneven image size!)\n");
-                    break;
-                }
-                g_fwImageWrittenSize += len;
-                ret = exec_write(dev->sock, handle, (uint8_t *) &fwdata, sizeof(fwdata));
-                if (ret)
-                {
-                    fseek(g_fwImageFile, offset, SEEK_SET);
-                    bRetry = 1;
-                    printf("(write retry)\n");
-                    break;
-                }
-                if (feof(g_fwImageFile) || g_fwImageWrittenSize == g_fwImageSize)
-                {
-                    bFinished = 1;
-                    break;
-                }
-            } // end for (i
-            g_fwImageWrittenPage++;
-            printf("\rUpdating ... %u/%u  page %u/%u (%2.0f%%)", g_fwImageWrittenSize, g_fwImageSize,
-                    g_fwImageWrittenPage, g_fwImagePage, (g_fwImageWrittenSize * 100.0) / g_fwImageSize);
-            fflush(stdout);
-            usleep(100);
-        }
-
-        // Done uploding in our end
-        if (bFinished) {
-            printf(" (data done)");
-            WEDFirmwareCommand fwcmd;
-            memset(&fwcmd, 0, sizeof(fwcmd));
-            fwcmd.pkt_type = WED_FIRMWARE_DATA_DONE;
-
-            ret = exec_write(dev->sock, handle, (uint8_t *) &fwcmd, sizeof(fwcmd));
-        }
-        fflush(stdout);
-
-        ret = exec_read(dev->sock, handle); // Continue polling
+        // Stream the pages of this round, as fast as the socket takes them
+        dev->fw_tx = FWUP_TX_BLOCKS;
+        dev->fw_tx_blocks = g_fwup_speedup * WED_FW_STREAM_BLOCKS;
+        ret = fwupdate_send(dev);
     } else if (fwstatus.status == WED_FWSTATUS_UPDATE_READY) {
-        if (g_fwImageWrittenSize != g_fwImageSize) {
+        if (dev->fw_written != g_fwImageSize) {
             fprintf(stderr, " Update not ready!\n");
             return -1;
         }
@@ -203,7 +175,7 @@ int process_fwstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
         memset(&fwcmd, 0, sizeof(fwcmd));
         fwcmd.pkt_type = WED_FIRMWARE_UPDATE;
 
-        ret = exec_write(dev->sock, handle, (uint8_t *) &fwcmd, sizeof(fwcmd));
+        ret = exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &fwcmd, sizeof(fwcmd));
         printf(" (Updating done)\n");
         // Done with command
         dev->state = STATE_COUNT;
@@ -213,3 +185,74 @@ int process_fwstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen) {
     }
     return ret;
 }
+
+// Send the firmware update stream, until the socket is full
+//  each step continues once the socket is writable,
+//  so the status read that ends a round is never refused either
+// Outputs:
+//   returns 0 if sent or waiting for the socket, -1 on error
+int fwupdate_send(amdev_t * dev) {
+    uint16_t handle = dev->chars[AMIIGO_UUID_FIRMWARE].value_handle;
+    int bFinished = 0;
+
+    switch (dev->fw_tx) {
+    case FWUP_TX_BLOCKS:
+        while (dev->fw_tx_blocks > 0) {
+            if (dev->fw_written >= g_fwImageSize) {
+                bFinished = 1;
+                if (g_opt.verbosity)
+                    printf("(ended)\n");
+                break;
+            }
+            // The block at the device offset is sent until the socket takes it
+            WEDFirmwareCommand fwcmd;
+            memset(&fwcmd, 0, sizeof(fwcmd));
+            fwcmd.pkt_type = WED_FIRMWARE_DATA_BLOCK;
+            memcpy(fwcmd.data, &g_fwImage[dev->fw_written], WED_FW_BLOCK_SIZE);
+            if (exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &fwcmd, sizeof(fwcmd))) {
+                if (errno == EAGAIN || errno == ENOBUFS)
+                    return session_wait_writable(dev); // Socket is full
+                return -1;
+            }
+            dev->fw_written += WED_FW_BLOCK_SIZE;
+            if (--dev->fw_tx_blocks % WED_FW_STREAM_BLOCKS == 0) {
+                dev->fw_page++;
+                printf("\rUpdating ... %u/%u  page %u/%u (%2.0f%%)", dev->fw_written, g_fwImageSize,
+                        dev->fw_page, g_fwImagePage, (dev->fw_written * 100.0) / g_fwImageSize);
+                fflush(stdout);
+            }
+            if (dev->fw_written == g_fwImageSize) {
+                bFinished = 1;
+                break;
+            }
+        }
+        // Done uploding in our end
+        dev->fw_tx = bFinished ? FWUP_TX_DONE : FWUP_TX_POLL;
+        return session_wait_writable(dev);
+    case FWUP_TX_DONE: {
+        WEDFirmwareCommand fwcmd;
+        memset(&fwcmd, 0, sizeof(fwcmd));
+        fwcmd.pkt_type = WED_FIRMWARE_DATA_DONE;
+        if (exec_write(dev->sock, dev->mtu, handle, (uint8_t *) &fwcmd, sizeof(fwcmd))) {
+            if (errno == EAGAIN || errno == ENOBUFS)
+                return session_wait_writable(dev);
+            return -1;
+        }
+        printf(" (data done)");
+        fflush(stdout);
+        dev->fw_tx = FWUP_TX_POLL;
+        return session_wait_writable(dev);
+    }
+    case FWUP_TX_POLL:
+    default:
+        dev->fw_tx = FWUP_TX_BLOCKS;
+        return trans_read(dev, handle, process_fwstatus); // Continue polling
+    }
+}
+
+// Poll the firmware update status
+int fwupdate_poll(amdev_t * dev) {
+    uint16_t handle = dev->chars[AMIIGO_UUID_FIRMWARE].value_handle;
+
+    return trans_read(dev, handle, process_fwstatus);
+}
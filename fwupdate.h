@@ -10,6 +10,8 @@
 #define FWUPDATE_H
 
 int set_update_file(const char * szName);
-int process_fwstatus(amdev_t * dev, uint8_t * buf, ssize_t buflen);
+int process_fwstatus(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen);
+int fwupdate_send(amdev_t * dev);
+int fwupdate_poll(amdev_t * dev);
 
 #endif // include guard
@@ -6,11 +6,12 @@
  * @copyright Amiigo Inc.
  */
 
+#define _GNU_SOURCE // for recvmmsg()
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
-
+#include <sys/socket.h>
 
 #include "jni/bluetooth.h"
 #include "jni/hci.h"
@@ -22,71 +23,25 @@
 #include "common.h"
 #include "amidefs.h"
 
-size_t g_buflen; // Established MTU
-
-// Read a characteristic
-// Inputs:
-//   sock   - socket to perform operation on
-//   handle - characteristics handle to read from
-int exec_read(int sock, uint16_t handle) {
-    if (handle == 0)
-        return -1;
-
-    uint8_t * buf = malloc(g_buflen);
-    memset(buf, 0, g_buflen);
-
-    uint16_t plen = enc_read_req(handle, buf, g_buflen);
-
-    ssize_t len = send(sock, buf, plen, 0);
-
-    free(buf);
-    if (len < 0 || len != plen) {
-        return -1;
-    }
-    return 0;
-}
-
 // Write to a characteristic
 // Inputs:
 //   sock   - socket to perform operation on
+//   mtu    - ATT MTU of the connection
 //   handle - characteristics handle to write to
 //   value  - value to write
 //   vlen   - size of value in bytes
-int exec_write(int sock, uint16_t handle, const uint8_t * value, size_t vlen) {
+int exec_write(int sock, uint16_t mtu, uint16_t handle, const uint8_t * value, size_t vlen) {
     if (handle == 0)
         return -1;
-
-    uint8_t * buf = malloc(g_buflen);
-    memset(buf, 0, g_buflen);
-    uint16_t plen = enc_write_cmd(handle, value, vlen, buf, g_buflen);
-
-    ssize_t len = send(sock, buf, plen, 0);
-
-    free(buf);
-    if (len < 0 || len != plen) {
+    // Value must fit in a single PDU, the device would reject or cut it
+    if (vlen > ATT_MAX_VALUE_LEN || vlen + 3 > mtu)
         return -1;
-    }
 
-    return 0;
-}
-
-// Write to a characteristic with response
-// Inputs:
-//   sock   - socket to perform operation on
-//   handle - characteristics handle to write to
-//   value  - value to write
-//   vlen   - size of value in bytes
-int exec_write_req(int sock, uint16_t handle, const uint8_t * value, size_t vlen) {
-    if (handle == 0)
-        return -1;
-
-    uint8_t * buf = malloc(g_buflen);
-    memset(buf, 0, g_buflen);
-    uint16_t plen = enc_write_req(handle, value, vlen, buf, g_buflen);
+    uint8_t buf[ATT_MAX_VALUE_LEN + 3];
+    uint16_t plen = enc_write_cmd(handle, value, vlen, buf, sizeof(buf));
 
     ssize_t len = send(sock, buf, plen, 0);
 
-    free(buf);
     if (len < 0 || len != plen) {
         return -1;
     }
@@ -94,30 +49,9 @@ int exec_write_req(int sock, uint16_t handle, const uint8_t * value, size_t vlen
     return 0;
 }
 
-// Find handle associated with given UUID
-int discover_handles(int sock, uint16_t start_handle, uint16_t end_handle) {
-    uint16_t plen;
-    bt_uuid_t type_uuid;
-
-    uint8_t * buf = malloc(g_buflen);
-    memset(buf, 0, g_buflen);
-
-    bt_uuid16_create(&type_uuid, GATT_CHARAC_UUID);
-
-    plen = enc_read_by_type_req(start_handle, end_handle, &type_uuid, buf,
-            g_buflen);
-
-    ssize_t len = send(sock, buf, plen, 0);
-
-    free(buf);
-    if (len < 0 || len != plen) {
-        return -1;
-    }
-    return 0;
-}
-
-// Connect and get GAP socket
-int gap_connect(const char * src, const char * dst) {
+// Start connecting and get GAP socket
+//  the returned socket is non-blocking and becomes writable once connected
+int gap_connect_start(const char * src, const char * dst) {
     int ret;
     struct set_opts opts;
     memset(&opts, 0, sizeof(opts));
@@ -173,6 +107,7 @@ int gap_connect(const char * src, const char * dst) {
         ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *) &opt_rcvbuf, sizeof(int));
         if (ret) {
             fprintf(stderr, "setsockopt SO_RCVBUF (%d)\n", errno);
+            close(sock);
             return -1;
         }
         // Increase socket's send buffer
@@ -180,23 +115,21 @@ int gap_connect(const char * src, const char * dst) {
         ret = setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *) &opt_sndbuf, sizeof(int));
         if (ret) {
             fprintf(stderr, "setsockopt SO_SNDBUF (%d)\n", errno);
+            close(sock);
             return -1;
         }
     }
 
-    int ready;
-    struct timeval tv;
-    fd_set write_fds;
-    tv.tv_sec = 5;
-    tv.tv_usec = 0;
-    FD_ZERO(&write_fds);
-    FD_SET(sock, &write_fds);
+    return sock;
+}
+
+// Finish connection once the socket started by gap_connect_start is writable
+// Outputs:
+//   mtu - ATT MTU to use until one is negotiated
+int gap_connect_finish(int sock, const char * src, const char * dst, uint16_t * mtu) {
+    struct set_opts opts;
+    memset(&opts, 0, sizeof(opts));
 
-    ready = select(sock + 1, NULL, &write_fds, NULL, &tv);
-    if (!(ready > 0 && FD_ISSET(sock, &write_fds))) {
-        fprintf(stderr, "Connection time out %d error (%d)\n", ready, errno);
-        return -1;
-    }
     {
         int soerr = 0;
         socklen_t olen = sizeof(soerr);
@@ -218,45 +151,67 @@ int gap_connect(const char * src, const char * dst) {
     bt_io_get(sock, BT_IO_OPT_OMTU, &opts.omtu, BT_IO_OPT_IMTU, &opts.imtu,
             BT_IO_OPT_CID, &opts.cid, BT_IO_OPT_INVALID);
 
-    g_buflen = (opts.cid == ATT_CID) ? ATT_DEFAULT_LE_MTU : opts.imtu;
+    *mtu = (opts.cid == ATT_CID) ? ATT_DEFAULT_LE_MTU : opts.imtu;
 
     printf("Session started ('q' to quit):\n\t"
             " SRC: %s OMTU: %d IMTU: %d CID: %d DST: %s\n\n", src, opts.omtu, opts.imtu,
             opts.cid, dst);
 
-    return sock;
+    return 0;
 }
 
-// Read data from gap socket
-int gap_recv(int sock, void * buf, size_t buflen) {
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 10000;
-
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(sock, &read_fds);
-
-    int ready = select(sock + 1, &read_fds, NULL, NULL, &tv);
-    if (ready == -1) {
-        fprintf(stderr, "main select() error\n");
+// Bound what can be queued on the socket but not yet taken by the controller
+//  writes then fail with EAGAIN once the window is full, and the socket is
+//  reported writable again as the controller drains it
+// Inputs:
+//   bytes - send buffer size (the kernel doubles it for its own overhead)
+int gap_send_window(int sock, int bytes) {
+    if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *) &bytes, sizeof(int))) {
+        fprintf(stderr, "setsockopt SO_SNDBUF (%d)\n", errno);
         return -1;
     }
+    return 0;
+}
 
-    int len = 0;
-    if (ready > 0 && FD_ISSET(sock, &read_fds)) {
-        len = (int)recv(sock, buf, buflen, 0);
-        if (len < 0) {
-            if (errno == EAGAIN) {
-                len = 0;
-            } else {
-                fprintf(stderr, "main recv() error (%d)\n", errno);
-                return -1;
-            }
-        }
+// Read all the queued PDUs from gap socket, in a single call
+// Inputs:
+//   bufs   - count buffers of buflen bytes each, back to back
+// Outputs:
+//   lens   - length of each PDU received
+//   returns number of PDUs received (0 if none queued), or -1 if the link is gone
+int gap_recv_batch(int sock, uint8_t * bufs, size_t buflen, int * lens, int count) {
+    struct mmsghdr msgs[count];
+    struct iovec iovs[count];
+    int i;
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < count; ++i) {
+        iovs[i].iov_base = &bufs[i * buflen];
+        iovs[i].iov_len = buflen;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(sock, msgs, count, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+        fprintf(stderr, "main recvmmsg() error (%d)\n", errno);
+        return -1;
     }
+    for (i = 0; i < n; ++i) {
+        // ATT PDUs are never empty, this is the peer closing the link
+        if (msgs[i].msg_len == 0)
+            return i > 0 ? i : -1;
+        lens[i] = msgs[i].msg_len;
+    }
+    return n;
+}
 
-    return len;
+// Get the HCI handle of the connection
+int gap_conn_handle(int sock, uint16_t * handle) {
+    *handle = 0;
+    if (!bt_io_get(sock, BT_IO_OPT_HANDLE, handle, BT_IO_OPT_INVALID))
+        return -1;
+    return 0;
 }
 
 // Shutdown the socket
@@ -9,17 +9,17 @@
 #ifndef GAPPROTO_H
 #define GAPPROTO_H
 
-int exec_read(int sock, uint16_t handle);
+int exec_write(int sock, uint16_t mtu, uint16_t handle, const uint8_t * value, size_t vlen);
 
-int exec_write(int sock, uint16_t handle, const uint8_t * value, size_t vlen);
+int gap_connect_start(const char * src, const char * dst);
 
-int exec_write_req(int sock, uint16_t handle, const uint8_t * value, size_t vlen);
+int gap_connect_finish(int sock, const char * src, const char * dst, uint16_t * mtu);
 
-int discover_handles(int sock, uint16_t start_handle, uint16_t end_handle);
+int gap_conn_handle(int sock, uint16_t * handle);
 
-int gap_connect(const char * src, const char * dst);
+int gap_send_window(int sock, int bytes);
 
-int gap_recv(int sock, void * buf, size_t buflen);
+int gap_recv_batch(int sock, uint8_t * bufs, size_t buflen, int * lens, int count);
 
 int gap_shutdown(int sock);
 
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
 
 #include "jni/bluetooth.h"
 #include "jni/hci.h"
@@ -16,7 +17,7 @@
 
 #include "hcitool.h"
 #include "amlprocess.h"
-extern char g_src[512];
+#include "amcmd.h"
 
 static volatile int signal_received = 0;
 
@@ -279,16 +280,20 @@ static int print_advertising_devices(int dd, uint8_t filter_type) {
     return 0;
 }
 
+// Find the HCI device of an adapter
+static int adapter_dev_id(const char * src) {
+    if (!strncmp(src, "hci", 3))
+        return atoi(src + 3);
+    fprintf(stderr, "Adapter %s is unknown, using the default\n", src);
+    return hci_get_route(NULL);
+}
+
 int do_lescan() {
     int dev_id, sock;
     int ret;
 
-    if (!strncmp(g_src, "hci", 3)) {
-        dev_id = atoi(g_src + 3);
-    } else {
-        fprintf(stderr, "Adapter %s is unknown, using the default\n", g_src);
-        dev_id = hci_get_route(NULL);
-    }
+    // Scan from the first adapter
+    dev_id = adapter_dev_id(g_cfg.src[0]);
     sock = hci_open_dev(dev_id);
     if (dev_id < 0 || sock < 0) {
         perror("opening socket");
@@ -322,3 +327,164 @@ int do_lescan() {
     return 0;
 }
 
+// Open the adapter to manage connections and hear about them
+//  non-blocking, only LE events, command status and command complete are received
+// Outputs:
+//   returns the HCI socket, or -1 on error (e.g. no priviledge)
+int le_conn_open(const char * src) {
+    int dev_id = adapter_dev_id(src);
+    if (dev_id < 0)
+        return -1;
+    int dd = hci_open_dev(dev_id);
+    if (dd < 0)
+        return -1;
+
+    struct hci_filter nf;
+    hci_filter_clear(&nf);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+    hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+    hci_filter_set_event(EVT_CMD_STATUS, &nf);
+    hci_filter_set_event(EVT_CMD_COMPLETE, &nf);
+    if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0 ||
+            fcntl(dd, F_SETFL, fcntl(dd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        hci_close_dev(dd);
+        return -1;
+    }
+    return dd;
+}
+
+// Ask the adapter to update a connection, completion comes as an event
+// Inputs:
+//   handle   - connection handle
+//   interval - connection interval in 1.25ms units
+//   timeout  - supervision timeout in 10ms units
+int le_conn_update(int dd, uint16_t handle, uint16_t interval, uint16_t timeout) {
+    le_connection_update_cp cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.handle = htobs(handle);
+    cp.min_interval = htobs(interval);
+    cp.max_interval = htobs(interval);
+    cp.latency = 0;
+    cp.supervision_timeout = htobs(timeout);
+    cp.min_ce_length = htobs(0x0001);
+    cp.max_ce_length = htobs(0x0001);
+    return hci_send_cmd(dd, OGF_LE_CTL, OCF_LE_CONN_UPDATE, LE_CONN_UPDATE_CP_SIZE, &cp);
+}
+
+// Ask the adapter for its whitelist size, completion comes as an event
+int le_wl_read_size(int dd) {
+    return hci_send_cmd(dd, OGF_LE_CTL, OCF_LE_READ_WHITE_LIST_SIZE, 0, NULL);
+}
+
+// Empty the whitelist of the adapter, completion comes as an event
+int le_wl_clear(int dd) {
+    return hci_send_cmd(dd, OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST, 0, NULL);
+}
+
+// Add a device to the whitelist of the adapter, completion comes as an event
+// Inputs:
+//   addr - device address
+int le_wl_add(int dd, const bdaddr_t * addr) {
+    le_add_device_to_white_list_cp cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.bdaddr_type = LE_PUBLIC_ADDRESS;
+    bacpy(&cp.bdaddr, addr);
+    return hci_send_cmd(dd, OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST, LE_ADD_DEVICE_TO_WHITE_LIST_CP_SIZE, &cp);
+}
+
+// Connect to whichever device in the whitelist advertises first
+//  completion comes as an event
+// Inputs:
+//   scan_interval - scan interval in 0.625ms units
+//   scan_window   - scan window in 0.625ms units
+//   min_interval  - shortest connection interval in 1.25ms units
+//   max_interval  - longest connection interval in 1.25ms units
+//   timeout       - supervision timeout in 10ms units
+int le_conn_create(int dd, uint16_t scan_interval, uint16_t scan_window,
+        uint16_t min_interval, uint16_t max_interval, uint16_t timeout) {
+    le_create_connection_cp cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.interval = htobs(scan_interval);
+    cp.window = htobs(scan_window);
+    cp.initiator_filter = 0x01; // Use the whitelist
+    cp.own_bdaddr_type = LE_PUBLIC_ADDRESS;
+    cp.min_interval = htobs(min_interval);
+    cp.max_interval = htobs(max_interval);
+    cp.latency = 0;
+    cp.supervision_timeout = htobs(timeout);
+    cp.min_ce_length = htobs(0x0001);
+    cp.max_ce_length = htobs(0x0001);
+    return hci_send_cmd(dd, OGF_LE_CTL, OCF_LE_CREATE_CONN, LE_CREATE_CONN_CP_SIZE, &cp);
+}
+
+// Stop connecting through the whitelist, completion comes as a failed connection event
+int le_conn_cancel(int dd) {
+    return hci_send_cmd(dd, OGF_LE_CTL, OCF_LE_CREATE_CONN_CANCEL, 0, NULL);
+}
+
+// Read the next connection event
+// Outputs:
+//   evt - the event
+//   returns 0 if an event is read, -1 if there is nothing to read
+int le_conn_event(int dd, le_conn_evt_t * evt) {
+    unsigned char buf[HCI_MAX_EVENT_SIZE];
+    memset(evt, 0, sizeof(*evt));
+    ssize_t len = read(dd, buf, sizeof(buf));
+    if (len < 0)
+        return -1;
+    if (len < 1 + HCI_EVENT_HDR_SIZE)
+        return 0;
+    hci_event_hdr * hdr = (hci_event_hdr *) (buf + 1);
+    unsigned char * ptr = buf + 1 + HCI_EVENT_HDR_SIZE;
+    len -= 1 + HCI_EVENT_HDR_SIZE;
+
+    if (hdr->evt == EVT_CMD_STATUS && len >= EVT_CMD_STATUS_SIZE) {
+        evt_cmd_status * cs = (evt_cmd_status *) ptr;
+        if (cs->status && btohs(cs->opcode) == cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CREATE_CONN)) {
+            evt->type = LE_EVT_CREATE_FAILED;
+            evt->status = cs->status;
+        }
+        return 0;
+    }
+    if (hdr->evt == EVT_CMD_COMPLETE && len > EVT_CMD_COMPLETE_SIZE) {
+        evt_cmd_complete * cc = (evt_cmd_complete *) ptr;
+        uint8_t * rp = ptr + EVT_CMD_COMPLETE_SIZE;
+        evt->status = rp[0];
+        switch (btohs(cc->opcode)) {
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_READ_WHITE_LIST_SIZE):
+            evt->type = LE_EVT_WL_SIZE;
+            if (len >= EVT_CMD_COMPLETE_SIZE + LE_READ_WHITE_LIST_SIZE_RP_SIZE)
+                evt->wl_size = ((le_read_white_list_size_rp *) rp)->size;
+            break;
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CLEAR_WHITE_LIST):
+            evt->type = LE_EVT_WL_CLEARED;
+            break;
+        case cmd_opcode_pack(OGF_LE_CTL, OCF_LE_ADD_DEVICE_TO_WHITE_LIST):
+            evt->type = LE_EVT_WL_ADDED;
+            break;
+        default:
+            evt->status = 0;
+            break;
+        }
+        return 0;
+    }
+    if (hdr->evt != EVT_LE_META_EVENT || len < EVT_LE_META_EVENT_SIZE)
+        return 0;
+    evt_le_meta_event * meta = (evt_le_meta_event *) ptr;
+    len -= EVT_LE_META_EVENT_SIZE;
+    if (meta->subevent == EVT_LE_CONN_COMPLETE && len >= EVT_LE_CONN_COMPLETE_SIZE) {
+        evt_le_connection_complete * cc = (evt_le_connection_complete *) meta->data;
+        evt->type = LE_EVT_CONNECTED;
+        evt->status = cc->status;
+        evt->handle = btohs(cc->handle);
+        evt->interval = btohs(cc->interval);
+        bacpy(&evt->peer, &cc->peer_bdaddr);
+    } else if (meta->subevent == EVT_LE_CONN_UPDATE_COMPLETE && len >= EVT_LE_CONN_UPDATE_COMPLETE_SIZE) {
+        evt_le_connection_update_complete * uc = (evt_le_connection_update_complete *) meta->data;
+        evt->type = LE_EVT_UPDATED;
+        evt->status = uc->status;
+        evt->handle = btohs(uc->handle);
+        evt->interval = btohs(uc->interval);
+    }
+    return 0;
+}
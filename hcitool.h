@@ -8,6 +8,41 @@
 #ifndef HCITOOL_H_
 #define HCITOOL_H_
 
+#include <stdint.h>
+
+#include "jni/bluetooth.h"
+
+// LE connection events
+typedef enum {
+    LE_EVT_OTHER = 0,      // Not of interest
+    LE_EVT_CONNECTED,      // Connection is created (or failed to)
+    LE_EVT_UPDATED,        // Connection is updated (or failed to)
+    LE_EVT_CREATE_FAILED,  // Connection creation is not started
+    LE_EVT_WL_SIZE,        // Whitelist size is read (or failed to)
+    LE_EVT_WL_CLEARED,     // Whitelist is emptied (or failed to)
+    LE_EVT_WL_ADDED,       // A device is added to the whitelist (or failed to)
+} LE_EVT_TYPE;
+
+// An LE connection event
+typedef struct _le_conn_evt {
+    LE_EVT_TYPE type;
+    uint8_t status;        // 0 on success, HCI error otherwise
+    uint16_t handle;       // Connection handle
+    uint16_t interval;     // Connection interval in effect in 1.25ms units
+    bdaddr_t peer;         // Device connected to
+    uint8_t wl_size;       // Devices the whitelist can take (LE_EVT_WL_SIZE)
+} le_conn_evt_t;
+
 int do_lescan();
 
+int le_conn_open(const char * src);
+int le_conn_update(int dd, uint16_t handle, uint16_t interval, uint16_t timeout);
+int le_wl_read_size(int dd);
+int le_wl_clear(int dd);
+int le_wl_add(int dd, const bdaddr_t * addr);
+int le_conn_create(int dd, uint16_t scan_interval, uint16_t scan_window,
+        uint16_t min_interval, uint16_t max_interval, uint16_t timeout);
+int le_conn_cancel(int dd);
+int le_conn_event(int dd, le_conn_evt_t * evt);
+
 #endif /* HCITOOL_H_ */
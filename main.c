@@ -11,11 +11,11 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <termios.h>
 #include <getopt.h>
 #include <time.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "amidefs.h"
 #include "amdev.h"
@@ -27,97 +27,17 @@
 #include "amlprocess.h"
 #include "cmdparse.h"
 #include "fwupdate.h"
+#include "amsession.h"
+#include "amctl.h"
+#include "amcache.h"
 
-extern void char_init(void);
 extern char g_szBaseName[256];
 
 int g_amver_major = 1;
 int g_amver_minor = 5;
 
-// TODO: have option of multiple sources
-char g_src[512] = "hci0"; // Device to connect from
-
 aml_options_t g_opt; // flags option
 
-// Execute the requested command
-int exec_command(amdev_t * dev) {
-    dev->started = 1;
-    switch (g_cmd) {
-    case AMIIGO_CMD_NONE:
-        dev->state = STATE_COUNT; // Done with command
-        break;
-    case AMIIGO_CMD_DOWNLOAD:
-        if (dev->status.num_log_entries == 0 && !g_opt.live) {
-            // Nothing to download!
-            dev->state = STATE_COUNT; // Done with command
-            return 0;
-        }
-
-        dev->state = STATE_DOWNLOAD; // Download in progress
-        dev->total_logs = dev->status.num_log_entries; // How many logs to download
-        return exec_download(dev->sock);
-        break;
-    case AMIIGO_CMD_CONFIGLS:
-        dev->state = STATE_COUNT; // Done with command
-        if (dev->ver_flat < FW_VERSION(1,8,117))
-            return exec_configls_18116(dev->sock);
-        else
-            return exec_configls(dev->sock);
-        break;
-    case AMIIGO_CMD_CONFIGACCEL:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_configaccel(dev->sock);
-        break;
-    case AMIIGO_CMD_CONFIGTEMP:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_configtemp(dev->sock);
-        break;
-    case AMIIGO_CMD_BLINK:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_blink(dev->sock);
-        break;
-    case AMIIGO_CMD_DEEPSLEEP:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_deepsleep(dev->sock);
-        break;
-    case AMIIGO_CMD_RESET_CPU:
-    case AMIIGO_CMD_RESET_LOGS:
-    case AMIIGO_CMD_RESET_CONFIGS:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_reset(dev->sock, g_cmd);
-        break;
-    case AMIIGO_CMD_FWUPDATE:
-        dev->state = STATE_FWSTATUS;
-        return exec_fwupdate(dev->sock);
-        break;
-    case AMIIGO_CMD_I2C_READ:
-    case AMIIGO_CMD_I2C_WRITE:
-        dev->state = STATE_I2C;
-        return exec_debug_i2c(dev->sock);
-        break;
-    case AMIIGO_CMD_RENAME:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_rename(dev->sock);
-        break;
-    case AMIIGO_CMD_TAG:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_tag(dev->sock);
-        break;
-    case AMIIGO_CMD_TEST_SEQ:
-        dev->state = STATE_COUNT; // Done with command
-        return exec_test_seq(dev->sock);
-        break;
-    case AMIIGO_CMD_EXTSTATUS:
-        dev->state = STATE_EXTSTATUS;
-        return exec_extstatus(dev->sock);
-        break;
-    default:
-        return 0;
-        break;
-    }
-    return 0;
-}
-
 void show_usage_screen(void) {
     printf("Amiigo Link command line utility version %d.%d\n", g_amver_major, g_amver_minor);
     printf("Usage: amlink [options] [command] [input|output]\n"
@@ -128,10 +48,14 @@ void show_usage_screen(void) {
             "    If specified handles are queried.\n"
             "  --i, --adapter uuid|hci<N>[,...]\n"
             "    Interface adapter(s) to use (default is hci0)\n"
+            "    Devices are spread across adapters, each adapter runs in its own thread.\n"
             "  --b, --device uuid1[,...] \n"
             "    Amiigo device(s) to connect to, default is shoepod then wristband.\n"
             "    Example: --b 90:59:AF:04:32:82\n"
             "    Use --lescan to find the UUID list\n"
+            "  --links N\n"
+            "    Maximum number of concurrent connections per adapter (default is %d).\n"
+            "    The rest of the devices are connected to as others finish.\n"
             "  --compressed Leave logs in compressed form.\n"
             "  --append append to end of file.\n"
             "  --raw Download logs in raw format (no compression).\n"
@@ -139,6 +63,22 @@ void show_usage_screen(void) {
             "    Hit `q` to end the stream.\n"
             "  --print\n"
             "    Print accelerometer to console as well as the log file.\n"
+            "  --daemon socket\n"
+            "    Keep the devices connected and serve requests on the given UNIX socket.\n"
+            "    Each request is a line of `<command> <device>`, replied by `ok ...` or `error ...`.\n"
+            "    With all the links in use, the device idle the longest is disconnected for a new one.\n"
+            "    Use --append to keep the logs of repeated downloads.\n"
+            "  --cache file\n"
+            "    Keep the handles found by --full discovery in this file (default is ~/%s).\n"
+            "    Cached handles are used until the firmware version changes, use \"\" to disable.\n"
+            "  --uring\n"
+            "    Receive and write logs through io_uring (Linux 6.0 or newer), to save CPU with many devices.\n"
+            "  --fast\n"
+            "    Download at the shortest connection interval, then go back to a power saving one.\n"
+            "    The adapter updates the connection if it can (needs root priviledge), otherwise the device is asked to.\n"
+            "  --whitelist\n"
+            "    Let the adapter connect to the devices as soon as they advertise (needs root priviledge).\n"
+            "    Devices waiting to connect are put in the adapter whitelist, instead of being connected one by one.\n"
             "Command:\n"
             "  --lescan \n"
             "    Low energy scan (needs root priviledge)\n"
@@ -179,8 +119,8 @@ void show_usage_screen(void) {
             "  temperature parameters: temp_slow_rate, temp_fast_rate, temp_sleep_rate\n"
             "Input Output: (optional) \n"
             "  If running download command, will be taken as output file\n"
-            "  Otherwise will be taken as input file name or line sequence\n"
-            );
+            "  Otherwise will be taken as input file name or line sequence\n",
+            DEFAULT_MAX_LINKS, CACHE_FILE_NAME);
     printf("\namlink is Copyright Amiigo inc\n");
 }
 
@@ -200,6 +140,12 @@ static void do_command_line(int argc, char * const argv[]) {
               { "version", 0, 0, 'V' },
               { "live", 0, 0, 'l' },
               { "full", 0, 0, 'a' },
+              { "links", 1, 0, 'n' },
+              { "daemon", 1, 0, 'D' },
+              { "uring", 0, 0, 'U' },
+              { "fast", 0, 0, 'F' },
+              { "whitelist", 0, 0, 'W' },
+              { "cache", 1, 0, 'C' },
               { "compressed", 0, 0, 'p'},
               { "raw", 0, 0, 'r'},
               { "append", 0, 0, 'A' },
@@ -263,6 +209,35 @@ static void do_command_line(int argc, char * const argv[]) {
             g_opt.full = 1;
             break;
 
+        case 'n':
+            g_opt.max_links = atoi(optarg);
+            if (g_opt.max_links <= 0) {
+                fprintf(stderr, "Invalid number of links (%s)!\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'D':
+            g_opt.ctl_path = optarg;
+            break;
+
+        case 'U':
+            g_opt.uring = 1;
+            break;
+
+        case 'F':
+            g_opt.fast = 1;
+            break;
+
+        case 'W':
+            g_opt.whitelist = 1;
+            break;
+
+        case 'C':
+            // Empty name disables the cache
+            g_opt.cache_path = optarg[0] ? optarg : NULL;
+            break;
+
         case 'p':
             g_opt.leave_compressed = 1;
             break;
@@ -348,25 +323,8 @@ static void do_command_line(int argc, char * const argv[]) {
     }
 }
 
-char kbhit() {
-    struct termios oldt, newt;
-    int ch;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~( ICANON | ECHO);
-    newt.c_cc[VMIN] = 0;
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    int nread = read(STDIN_FILENO, &ch, 1);
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    if (nread == 1)
-        return ch;
-    else
-        return 0;
-}
-
 int main(int argc, char **argv) {
     int ret, i;
-    time_t start_time[MAX_DEV_COUNT], stop_time[MAX_DEV_COUNT], download_time[MAX_DEV_COUNT];
 
     // do not buffer output
     setbuf(stdout, NULL);
@@ -375,138 +333,91 @@ int main(int argc, char **argv) {
     char_init();
     // Initialize the command configs
     cmd_init();
-
-    // Amiigo devices to interact with
-    amdev_t devices[MAX_DEV_COUNT];
-    // zero-fill the devices state
-    memset(&devices[0], 0, sizeof(devices));
+    g_opt.max_links = DEFAULT_MAX_LINKS;
+    static char szCachePath[1024];
+    const char * szHome = getenv("HOME");
+    if (szHome != NULL) {
+        snprintf(szCachePath, sizeof(szCachePath), "%s/%s", szHome, CACHE_FILE_NAME);
+        g_opt.cache_path = szCachePath;
+    }
 
     // Set parameters based on command line
     do_command_line(argc, argv);
 
-    for (i = 0; i < g_cfg.count_dst; ++i) {
-        amdev_t * dev = &devices[i];
-        dev->dev_idx = i; // Keep the index for reference
-        // Connect to all devices
-        dev->sock = gap_connect(g_src, g_cfg.dst[i]);
-        if (dev->sock < 0) {
-            return -1;
-        }
-        if (g_opt.full) {
-            // Start by discovering Amiigo handles
-            ret = discover_handles(dev->sock, OPT_START_HANDLE, OPT_END_HANDLE);
-            if (ret) {
-                fprintf(stderr, "discover_handles() error %d in %s\n", ret, g_cfg.dst[i]);
-                return -1;
-            }
-        } else {
-            // Use default handles and discover the device
-            ret = discover_device(dev);
-            if (ret) {
-                fprintf(stderr, "discover_device() error %d in %s\n", ret, g_cfg.dst[i]);
-                return -1;
-            }
-        }
+    // Handles found in earlier runs
+    cache_load(g_opt.cache_path);
 
-        // Timing of downloads
-        start_time[i]= time(NULL);
-        stop_time[i] = start_time[i];
-        download_time[i] = start_time[i];
+    // Name the log files before sessions start downloading
+    log_init();
+
+    // Watch for user input and signals, before any thread starts
+    if (ctl_init()) {
+        ctl_close();
+        return -1;
     }
 
-    int done_count = 0; // Number of devices done with their command
-    int dev_idx = g_cfg.count_dst - 1;
-    for (;;) {
-        // See if user ended the run
-        if (kbhit() == 'q')
-            break;
-        dev_idx--;
-        if (dev_idx < 0)
-            dev_idx = g_cfg.count_dst - 1;
-        amdev_t * dev = &devices[dev_idx];
-
-        // No need to keep-alive during firmware update
-        if (dev->state != STATE_FWSTATUS_WAIT) {
-            stop_time[dev_idx] = time(NULL);
-            double diff = difftime(stop_time[dev_idx], start_time[dev_idx]);
-            // Keep-alive by reading status every 60s
-            if (diff > 60) {
-                if (g_opt.verbosity)
-                    printf(" (Keep alive %s)\n", g_cfg.dst[dev_idx]);
-                start_time[dev_idx] = stop_time[dev_idx];
-                // Read the status to keep conection alive
-                exec_status(dev->sock);
-            }
-            // If downloading (non-live) and not already done
-            if (dev->state == STATE_DOWNLOAD && !g_opt.live && !dev->done) {
-                diff = difftime(stop_time[dev_idx], download_time[dev_idx]);
-                // Download timeout reached
-                if (diff > 2)
-                {
-                    printf(" (Timeout %s)\n", g_cfg.dst[dev_idx]);
-                    break;
-                }
-            }
+    // Spread the devices across the adapters
+    amsession_t sessions[MAX_SRC_COUNT];
+    for (i = 0; i < g_cfg.count_src; ++i) {
+        if (session_init(&sessions[i], i, g_cfg.src[i])) {
+            ctl_close();
+            return -1;
         }
+    }
+    for (i = 0; i < g_cfg.count_src; ++i) {
+        amsession_t * session = &sessions[i];
+        session->dst_idx = malloc(sizeof(int) * (g_cfg.count_dst / g_cfg.count_src + 1));
+        if (session->dst_idx == NULL) {
+            fprintf(stderr, "Not enough memory for %d devices\n", g_cfg.count_dst);
+            ctl_close();
+            return -1;
+        }
+    }
+    for (i = 0; i < g_cfg.count_dst; ++i) {
+        amsession_t * session = &sessions[session_of_device(i)];
+        session->dst_idx[session->count++] = i;
+    }
 
-        uint8_t buf[1024] = {0};
-        int len = gap_recv(dev->sock, &buf[0], sizeof(buf));
-        if (len < 0)
-            break;
-        if (len == 0)
+    // Each adapter gets its own I/O thread
+    int session_count = 0;
+    amsession_t * started[MAX_SRC_COUNT];
+    // Hold a reference until all sessions are started, so early finishers do not end the wait
+    __sync_fetch_and_add(&g_running_sessions, 1);
+    for (i = 0; i < g_cfg.count_src; ++i) {
+        amsession_t * session = &sessions[i];
+        if (session->count == 0)
             continue;
-
-        // Last time apacket came
-        download_time[dev_idx] = stop_time[dev_idx];
-
-        // Process incoming data
-        ret = process_data(dev, buf, len);
+        __sync_fetch_and_add(&g_running_sessions, 1);
+        ret = pthread_create(&session->thread, NULL, session_thread, session);
         if (ret) {
-            fprintf(stderr, "main process_data() error %d in %s\n", ret, g_cfg.dst[dev_idx]);
+            fprintf(stderr, "pthread_create() error %d for %s\n", ret, session->src);
+            __sync_fetch_and_sub(&g_running_sessions, 1);
+            ctl_stop();
             break;
         }
+        started[session_count++] = session;
+    }
 
-        // If all devices have their status read, execute the requested command
-        if (dev->status.battery_level > 0 && dev->state != STATE_COUNT && !dev->started) {
-            // Now that we have status (e.g. number of logs) of all devices
-            //  Start execution of the requested command
-            ret = exec_command(dev);
-            if (ret) {
-                fprintf(stderr, "exec_command() error %d in %s\n", ret, g_cfg.dst[dev_idx]);
-                break;
-            }
-        }
-
-        if (dev->state == STATE_COUNT) {
-            if (!dev->done) {
-                dev->done = 1;
-                done_count++;
-            }
-            // Done the the command on all devices
-            if (done_count == g_cfg.count_dst)
-                break;
-        }
-
-    } //end for(;;
-
-    for (i = 0; i < g_cfg.count_dst; ++i) {
-        amdev_t * dev = &devices[i];
-        // Reset CPU if need to exit in the middle of firmware update
-        if (dev->state == STATE_FWSTATUS_WAIT)
-            exec_reset(dev->sock, AMIIGO_CMD_RESET_CPU);
-
+    if (__sync_sub_and_fetch(&g_running_sessions, 1) == 0)
+        ctl_sessions_done();
 
-        // Close the socket
-        gap_shutdown(dev->sock);
+    // Watch for the user ending the run while sessions are in progress
+    if (ctl_run(sessions))
+        ctl_stop();
 
-        // Close log files
-        if (dev->logFile != NULL)
-        {
-            fclose(dev->logFile);
-            dev->logFile = NULL;
-        }
-    } // } //end for(
+    int failed_count = 0;
+    for (i = 0; i < session_count; ++i) {
+        pthread_join(started[i]->thread, NULL);
+        failed_count += started[i]->failed_count;
+    }
+    for (i = 0; i < g_cfg.count_src; ++i)
+        session_release(&sessions[i]);
+    ctl_close();
 
     printf("\n");
+    if (failed_count) {
+        fprintf(stderr, "%d of %d devices failed\n", failed_count, g_cfg.count_dst);
+        return -1;
+    }
     return 0;
 }
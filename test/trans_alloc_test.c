@@ -0,0 +1,173 @@
+/*
+ * Amiigo Link ATT transactions allocation test
+ *
+ * @date Oct 17, 2026
+ * @author: dashesy
+ * @copyright Amiigo Inc.
+ *
+ * @notes:
+ *
+ *  malloc, calloc, realloc and free are wrapped (-Wl,--wrap) and counted,
+ *  then full queues of read-by-type requests are answered and their responses iterated:
+ *  once the pool is prepared none of that may allocate
+ *  one request past a full pool must allocate once, free once, and be counted as a spill
+ *  build and run with "make test"
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "jni/bluetooth.h"
+#include "att.h"
+
+#include "common.h"
+#include "amdev.h"
+#include "amtrans.h"
+
+#define ROUNDS 1000          // Full queues to go through
+#define ENTRY_LEN 7          // Declaration entry: handle, properties, value handle, 16-bit UUID
+#define ENTRIES 3            // Entries in each response
+
+aml_options_t g_opt;
+amcfg_t g_cfg;
+
+static int g_allocs = 0;     // Allocations while counting
+static int g_frees = 0;      // Releases while counting
+static int g_counting = 0;   // If allocations are counted
+static int g_entries = 0;    // Response entries iterated
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t nmemb, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+void __real_free(void * ptr);
+
+void * __wrap_malloc(size_t size) {
+    g_allocs += g_counting;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t nmemb, size_t size) {
+    g_allocs += g_counting;
+    return __real_calloc(nmemb, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size) {
+    g_allocs += g_counting;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void * ptr) {
+    g_frees += g_counting && ptr != NULL;
+    __real_free(ptr);
+}
+
+// Iterate the declarations in place, as discovery does
+static int read_by_type_done(amdev_t * dev, uint8_t status, uint8_t * buf, ssize_t buflen) {
+    struct att_data_iter iter;
+    const uint8_t * data;
+    if (status || dec_read_by_type_resp_iter(buf, buflen, &iter) != ENTRIES)
+        return -1;
+    while ((data = att_data_iter_next(&iter)) != NULL) {
+        if (att_get_u16(&data[5]) != 0x2A00 + g_entries % ENTRIES)
+            return -1;
+        g_entries++;
+    }
+    return 0;
+}
+
+// Queue count read-by-type requests, then answer each one as the device would
+// Outputs:
+//   returns 0 if all were answered and iterated
+static int run_queue(amdev_t * dev, int peer, int count) {
+    uint8_t req[ATT_MTU_MAX];
+    uint8_t rsp[2 + ENTRIES * ENTRY_LEN];
+    int i, j;
+    for (i = 0; i < count; ++i) {
+        if (trans_read_by_type(dev, 1 + i, 0xffff, GATT_CHARAC_UUID, read_by_type_done))
+            return -1;
+    }
+    for (i = 0; i < count; ++i) {
+        // Requests go out one at a time, each once the one before is answered
+        if (recv(peer, req, sizeof(req), 0) < 5 || req[0] != ATT_OP_READ_BY_TYPE_REQ)
+            return -1;
+        rsp[0] = ATT_OP_READ_BY_TYPE_RESP;
+        rsp[1] = ENTRY_LEN;
+        for (j = 0; j < ENTRIES; ++j) {
+            uint8_t * entry = &rsp[2 + j * ENTRY_LEN];
+            att_put_u16(10 + 3 * j, &entry[0]);
+            entry[2] = ATT_CHAR_PROPER_READ;
+            att_put_u16(11 + 3 * j, &entry[3]);
+            att_put_u16(0x2A00 + j, &entry[5]);
+        }
+        if (trans_response(dev, rsp, sizeof(rsp)))
+            return -1;
+    }
+    return dev->trans == NULL && dev->trans_queue == NULL ? 0 : -1;
+}
+
+int main(void) {
+    amtimers_t timers;
+    amdev_t * dev = calloc(1, sizeof(amdev_t));
+    static char szDst[] = "11:22:33:44:55:66";
+    static char * dst[] = { szDst };
+    int sv[2], i, failed = 0;
+
+    g_cfg.dst = dst;
+    g_cfg.count_dst = 1;
+    if (dev == NULL || timers_init(&timers) || socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) {
+        fprintf(stderr, "Cannot prepare the test\n");
+        return 1;
+    }
+    dev->sched = &timers;
+    for (i = 0; i < TIMER_COUNT; ++i)
+        timer_init(&dev->timers[i], i, dev);
+    dev->sock = sv[0];
+    dev->mtu = ATT_DEFAULT_LE_MTU;
+    if (trans_init(dev)) {
+        fprintf(stderr, "Cannot prepare the request pool\n");
+        return 1;
+    }
+
+    // First round grows the timer heap, as the connect deadline does on a real link
+    if (run_queue(dev, sv[1], TRANS_POOL_SIZE)) {
+        fprintf(stderr, "FAIL: requests not answered\n");
+        return 1;
+    }
+    g_entries = 0;
+
+    // Steady state, a full pool at a time
+    g_counting = 1;
+    for (i = 0; i < ROUNDS && !failed; ++i)
+        failed = run_queue(dev, sv[1], TRANS_POOL_SIZE);
+    g_counting = 0;
+    printf("steady state: %d requests, %d entries, %d allocations, %d spills\n",
+            ROUNDS * TRANS_POOL_SIZE, g_entries, g_allocs, dev->trans_spills);
+    if (failed || g_entries != ROUNDS * TRANS_POOL_SIZE * ENTRIES || g_allocs || g_frees || dev->trans_spills) {
+        fprintf(stderr, "FAIL: steady state requests must not allocate\n");
+        return 1;
+    }
+
+    // One request past the pool
+    g_entries = 0;
+    g_counting = 1;
+    failed = run_queue(dev, sv[1], TRANS_POOL_SIZE + 1);
+    g_counting = 0;
+    printf("past the pool: %d allocations, %d frees, %d spills\n", g_allocs, g_frees, dev->trans_spills);
+    if (failed || g_allocs != 1 || g_frees != 1 || dev->trans_spills != 1) {
+        fprintf(stderr, "FAIL: a request past the pool must allocate once and be counted\n");
+        return 1;
+    }
+
+    trans_free(dev);
+    timers_close(&timers);
+    close(sv[0]);
+    close(sv[1]);
+    free(dev);
+    printf("PASS\n");
+    return 0;
+}